@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+
+#include "cpu_renderer.h"
+
+struct BuddhabrotCPURenderer::Worker
+{
+    // Bin entries: pixel within the tile and band in the key, fixed-point amount
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> amounts;
+    std::vector<int> fill;
+    // Samples of the task being splatted
+    std::vector<float> samples;
+    // Adaptive feedback: visible points and orbits drawn per importance cell this frame
+    std::vector<uint32_t> cellVisible;
+    std::vector<uint32_t> cellSamples;
+    uint32_t random;
+    long long points;
+};
+
+// Iterate one sample like the accumulation geometry shader and call
+// emit(ix, iy, band) for every orbit point inside the render target
+template <typename Emit>
+inline void splat_orbit(const FractalTransform &t, float cx, float cy, int size, Emit emit)
+{
+    float zx = 0, zy = 0;
+    int diverge = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        t.iterate(zx, zy, cx, cy);
+        if (zx * zx + zy * zy >= 16.0f)
+        {
+            diverge = i;
+            break;
+        }
+    }
+    if (diverge == 0)
+        return;
+    int band = diverge < 80 ? 0 : (diverge < 160 ? 1 : 2);
+    zx = 0;
+    zy = 0;
+    for (int i = 0; i < diverge; i++)
+    {
+        t.iterate(zx, zy, cx, cy);
+        if (i < 1)
+            continue;
+        float px, py;
+        t.project(zx, zy, cx, cy, px, py);
+        int ix = (int)floor((px / 2.0f + 1.0f) * 0.5f * size);
+        int iy = (int)floor((py / 2.0f + 1.0f) * 0.5f * size);
+        if (ix < 0 || iy < 0 || ix >= size || iy >= size)
+            continue;
+        emit(ix, iy, band);
+    }
+}
+
+BuddhabrotCPURenderer::BuddhabrotCPURenderer(const BuddhabrotRendererOptions &_options, TaskPool &_pool)
+    : options(_options), pool(&_pool)
+{
+    mipmapSize = options.samplerSize >> options.samplerMipmapLevel;
+    escapes.resize(options.samplerSize * options.samplerSize);
+    histogram.resize(options.renderSize * options.renderSize * 3);
+    samplesCount = 0;
+
+    sampler = sampler_create();
+    sampler_set_size(sampler, mipmapSize, mipmapSize);
+    sampler_set_lower_bound(sampler, options.samplerLowerBound);
+    sampler_set_jitter(sampler, options.samplerJitter);
+    sampler_set_adaptive(sampler, options.samplerAdaptiveLevels, options.samplerAdaptiveStrength);
+    adaptive = options.samplerAdaptiveLevels > 0 && options.samplerAdaptiveStrength > 0;
+    sampler_set_chunk_size(sampler, options.samplerChunkSize > 0 ? options.samplerChunkSize : 65536);
+
+    binned = true;
+    tilesX = (options.renderSize + TileSize - 1) / TileSize;
+    tileLocks = new std::atomic_flag[tilesX * tilesX];
+    for (int i = 0; i < tilesX * tilesX; i++)
+        tileLocks[i].clear();
+    histogramResolved = true;
+    pointsCount = 0;
+    accumulateSeconds = 0;
+    symmetry = FRACTAL_SYMMETRY_NONE;
+    seeds = nullptr;
+    usingSeeds = false;
+}
+
+void BuddhabrotCPURenderer::setSeed(int seed)
+{
+    sampler_set_seed(sampler, seed);
+}
+
+void BuddhabrotCPURenderer::renderImportance()
+{
+    // Same as the importance shader: escape iteration per pixel center, stored as R8
+    FractalTransform t = options.fractal->getTransform();
+    int size = options.samplerSize;
+    int maxIterations = options.samplerMaxIterations;
+    // The sampler only reads the c.y >= 0 half when mirroring
+    int firstRow = symmetry != FRACTAL_SYMMETRY_NONE ? size / 2 : 0;
+    pool->parallelFor(size - firstRow, [&](int begin, int end, int) {
+        for (int py = firstRow + begin; py < firstRow + end; py++)
+        {
+            for (int px = 0; px < size; px++)
+            {
+                float cx = (px + 0.5f) / size * 4.0f - 2.0f;
+                float cy = (py + 0.5f) / size * 4.0f - 2.0f;
+                int visible;
+                escapes[py * size + px] = t.importanceEscape(cx, cy, maxIterations, visible);
+            }
+        }
+    });
+
+    // Box-filter down to the sampler's mipmap level
+    int block = 1 << options.samplerMipmapLevel;
+    unsigned char *buffer = sampler_get_buffer(sampler);
+    pool->parallelFor(mipmapSize, [&](int begin, int end, int) {
+        for (int y = begin; y < end; y++)
+        {
+            for (int x = 0; x < mipmapSize; x++)
+            {
+                int sum = 0;
+                for (int by = 0; by < block; by++)
+                {
+                    for (int bx = 0; bx < block; bx++)
+                        sum += escapes[(y * block + by) * size + x * block + bx];
+                }
+                buffer[y * mipmapSize + x] = (sum + block * block / 2) / (block * block);
+            }
+        }
+    });
+}
+
+void BuddhabrotCPURenderer::countVisible(Worker &worker, float cx, float cy, long long visible)
+{
+    int x = (int)floor((cx + 2.0f) * 0.25f * mipmapSize);
+    int y = (int)floor((cy + 2.0f) * 0.25f * mipmapSize);
+    x = x < 0 ? 0 : (x >= mipmapSize ? mipmapSize - 1 : x);
+    y = y < 0 ? 0 : (y >= mipmapSize ? mipmapSize - 1 : y);
+    worker.cellVisible[y * mipmapSize + x] += (uint32_t)visible;
+    worker.cellSamples[y * mipmapSize + x]++;
+}
+
+void BuddhabrotCPURenderer::updateContribution()
+{
+    // Mean visible points of the orbits drawn from each cell, the quantity the
+    // sampler's history expects; cells nothing was drawn from report 0
+    unsigned char *contribution = sampler_get_contribution_buffer(sampler);
+    pool->parallelFor(mipmapSize * mipmapSize, [&](int begin, int end, int) {
+        for (int cell = begin; cell < end; cell++)
+        {
+            long long visible = 0, samples = 0;
+            for (Worker *worker : workers)
+            {
+                visible += worker->cellVisible[cell];
+                samples += worker->cellSamples[cell];
+                worker->cellVisible[cell] = 0;
+                worker->cellSamples[cell] = 0;
+            }
+            long long mean = samples > 0 ? (visible + samples / 2) / samples : 0;
+            contribution[cell] = (unsigned char)(mean < 255 ? mean : 255);
+        }
+    });
+}
+
+void BuddhabrotCPURenderer::accumulateScattered(const FractalTransform &t, const float *samples, int count)
+{
+    int size = options.renderSize;
+    float *data = &histogram[0];
+    for (int s = 0; s < count; s++)
+    {
+        float weight = samples[s * 3 + 2];
+        long long before = pointsCount;
+        splat_orbit(t, samples[s * 3 + 0], samples[s * 3 + 1], size, [&](int ix, int iy, int band) {
+            data[(iy * size + ix) * 3 + band] += weight;
+            pointsCount++;
+        });
+        if (adaptive && !usingSeeds)
+            countVisible(*workers[0], samples[s * 3 + 0], samples[s * 3 + 1], pointsCount - before);
+    }
+}
+
+void BuddhabrotCPURenderer::flushBin(Worker &worker, int tile)
+{
+    int n = worker.fill[tile];
+    const uint32_t *keys = &worker.keys[tile * BinCapacity];
+    const uint32_t *amounts = &worker.amounts[tile * BinCapacity];
+    uint32_t *data = &counters[(size_t)tile * TileSize * TileSize * 3];
+    while (tileLocks[tile].test_and_set(std::memory_order_acquire))
+        ;
+    for (int i = 0; i < n; i++)
+        data[keys[i]] += amounts[i];
+    tileLocks[tile].clear(std::memory_order_release);
+    worker.fill[tile] = 0;
+}
+
+void BuddhabrotCPURenderer::accumulateBinned(Worker &worker, const FractalTransform &t, const float *samples, int count)
+{
+    int size = options.renderSize;
+    for (int s = 0; s < count; s++)
+    {
+        float weight = samples[s * 3 + 2] * CounterScale;
+        long long before = worker.points;
+        splat_orbit(t, samples[s * 3 + 0], samples[s * 3 + 1], size, [&](int ix, int iy, int band) {
+            // Stochastic rounding keeps the fixed-point counters unbiased
+            uint32_t r = worker.random;
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+            worker.random = r;
+            uint32_t amount = (uint32_t)(weight + (r >> 8) * (1.0f / 16777216.0f));
+            int tile = (iy >> TileShift) * tilesX + (ix >> TileShift);
+            int local = ((iy & (TileSize - 1)) << TileShift) | (ix & (TileSize - 1));
+            int slot = tile * BinCapacity + worker.fill[tile]++;
+            worker.keys[slot] = local * 3 + band;
+            worker.amounts[slot] = amount;
+            worker.points++;
+            if (worker.fill[tile] == BinCapacity)
+                flushBin(worker, tile);
+        });
+        if (adaptive && !usingSeeds)
+            countVisible(worker, samples[s * 3 + 0], samples[s * 3 + 1], worker.points - before);
+    }
+}
+
+void BuddhabrotCPURenderer::createWorkers()
+{
+    int n = pool->getWorkerCount();
+    while ((int)workers.size() < n)
+    {
+        Worker *worker = new Worker();
+        worker->keys.resize(tilesX * tilesX * BinCapacity);
+        worker->amounts.resize(tilesX * tilesX * BinCapacity);
+        worker->fill.assign(tilesX * tilesX, 0);
+        worker->random = 0x9e3779b9U * (uint32_t)(workers.size() + 1);
+        worker->points = 0;
+        if (adaptive)
+        {
+            worker->cellVisible.assign(mipmapSize * mipmapSize, 0);
+            worker->cellSamples.assign(mipmapSize * mipmapSize, 0);
+        }
+        workers.push_back(worker);
+    }
+}
+
+void BuddhabrotCPURenderer::accumulateCells(const FractalTransform &t)
+{
+    // An orbit costs about twice its escape iteration; cells that did not
+    // escape in the importance map run the full divergence test
+    int size = options.samplerSize;
+    int block = 1 << options.samplerMipmapLevel;
+    auto cost = [&](int cell) -> float {
+        int px = (cell % mipmapSize) * block + block / 2;
+        int py = (cell / mipmapSize) * block + block / 2;
+        int escape = escapes[py * size + px];
+        return sampler_get_cell_samples(sampler, cell) * (escape > 0 ? 2.0f * escape : 256.0f);
+    };
+    // Every task samples its own range of cells, at most a chunk at a time, and
+    // splats it right away; the range start seeds its Gaussian offsets
+    int chunk = options.samplerChunkSize > 0 ? options.samplerChunkSize : 65536;
+    pool->parallelFor(mipmapSize * mipmapSize,
+                      [&](int begin, int end, int worker) {
+                          Worker &w = *workers[worker];
+                          int cell = begin;
+                          while (cell < end)
+                          {
+                              int first = cell, count = 0;
+                              while (cell < end && (count == 0 || count + sampler_get_cell_samples(sampler, cell) <= chunk))
+                                  count += sampler_get_cell_samples(sampler, cell++);
+                              if (count == 0)
+                                  continue;
+                              if (w.samples.size() < (size_t)count * 3)
+                                  w.samples.resize((size_t)count * 3);
+                              sampler_sample_cells(sampler, first, cell, first, &w.samples[0]);
+                              accumulateBinned(w, t, &w.samples[0], count);
+                          }
+                      },
+                      cost);
+}
+
+void BuddhabrotCPURenderer::accumulateSeeds(const FractalTransform &t)
+{
+    // Seeds come sorted by escape iteration, so runs of samples already cost
+    // about the same and the escape map is not rendered
+    int chunk = options.samplerChunkSize > 0 ? options.samplerChunkSize : 65536;
+    pool->parallelFor(samplesCount, [&](int begin, int end, int worker) {
+        Worker &w = *workers[worker];
+        for (int first = begin; first < end; first += chunk)
+        {
+            int count = std::min(chunk, end - first);
+            if (w.samples.size() < (size_t)count * 3)
+                w.samples.resize((size_t)count * 3);
+            count = seeds->sampleRange(first, first + count, &w.samples[0]);
+            accumulateBinned(w, t, &w.samples[0], count);
+        }
+    });
+}
+
+const float *BuddhabrotCPURenderer::getHistogram()
+{
+    if (!histogramResolved)
+    {
+        int size = options.renderSize;
+        // Untile the counters into the row-major float histogram
+        if (binned)
+        {
+            pool->parallelFor(size, [&](int begin, int end, int) {
+                for (int iy = begin; iy < end; iy++)
+                {
+                    for (int ix = 0; ix < size; ix++)
+                    {
+                        int tile = (iy >> TileShift) * tilesX + (ix >> TileShift);
+                        int local = ((iy & (TileSize - 1)) << TileShift) | (ix & (TileSize - 1));
+                        const uint32_t *c = &counters[((size_t)tile * TileSize * TileSize + local) * 3];
+                        float *h = &histogram[(iy * size + ix) * 3];
+                        for (int b = 0; b < 3; b++)
+                            h[b] = c[b] * (1.0f / CounterScale);
+                    }
+                }
+            });
+        }
+        mirror_histogram(&histogram[0], size, symmetry);
+        histogramResolved = true;
+    }
+    return &histogram[0];
+}
+
+void BuddhabrotCPURenderer::render()
+{
+    FractalTransform t = options.fractal->getTransform();
+    usingSeeds = seeds != nullptr && seeds->getKey() == options.fractal->getOrbitKey(options.importanceCacheTolerance) &&
+                 seeds->isCompatible(options.samplerSize, options.samplerMipmapLevel, options.samplerMaxIterations) &&
+                 (seeds->getSymmetry() == FRACTAL_SYMMETRY_NONE || seeds->getSymmetry() == t.getSymmetry());
+    if (usingSeeds)
+    {
+        symmetry = seeds->getSymmetry();
+    }
+    else
+    {
+        symmetry = options.exploitSymmetry ? t.getSymmetry() : FRACTAL_SYMMETRY_NONE;
+        sampler_set_half_plane(sampler, symmetry != FRACTAL_SYMMETRY_NONE);
+        renderImportance();
+    }
+    pointsCount = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (binned)
+    {
+        counters.assign((size_t)tilesX * tilesX * TileSize * TileSize * 3, 0);
+        for (Worker *worker : workers)
+            worker->points = 0;
+    }
+    else
+    {
+        memset(&histogram[0], 0, sizeof(float) * histogram.size());
+    }
+
+    if (usingSeeds)
+    {
+        int budget = symmetry != FRACTAL_SYMMETRY_NONE ? options.samplerLowerBound / 2 : options.samplerLowerBound;
+        double cell = 4.0 / mipmapSize;
+        samplesCount = seeds->prepare(budget, cell * cell);
+    }
+    else
+    {
+        samplesCount = sampler_prepare(sampler);
+    }
+    // The scattered path keeps its adaptive feedback in the first worker
+    createWorkers();
+    if (binned)
+    {
+        if (usingSeeds)
+            accumulateSeeds(t);
+        else
+            accumulateCells(t);
+    }
+    else
+    {
+        // The scattered path writes the histogram directly, one chunk at a time
+        int count;
+        if (usingSeeds)
+        {
+            seedChunk.resize((options.samplerChunkSize > 0 ? options.samplerChunkSize : 65536) * 3);
+            while ((count = seeds->sampleInto(&seedChunk[0], seedChunk.size() / 3)) > 0)
+                accumulateScattered(t, &seedChunk[0], count);
+        }
+        else
+        {
+            while ((count = sampler_next_chunk(sampler)) > 0)
+                accumulateScattered(t, sampler_get_chunk(sampler), count);
+        }
+    }
+    if (binned)
+    {
+        // Merge the remaining bins tile by tile, so no two tasks touch the same tile
+        pool->parallelFor(tilesX * tilesX, [&](int begin, int end, int) {
+            for (int tile = begin; tile < end; tile++)
+            {
+                for (Worker *worker : workers)
+                {
+                    if (worker->fill[tile] > 0)
+                        flushBin(*worker, tile);
+                }
+            }
+        });
+        for (Worker *worker : workers)
+            pointsCount += worker->points;
+    }
+    accumulateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Seeds bypass the sampler, so only importance frames teach it
+    if (adaptive && !usingSeeds)
+        updateContribution();
+    histogramResolved = false;
+}
+
+BuddhabrotCPURenderer::~BuddhabrotCPURenderer()
+{
+    for (Worker *worker : workers)
+        delete worker;
+    delete[] tileLocks;
+    sampler_destroy(sampler);
+}
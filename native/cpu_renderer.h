@@ -0,0 +1,93 @@
+#ifndef BUDDHABROT_RENDERER_CPU_RENDERER_H
+#define BUDDHABROT_RENDERER_CPU_RENDERER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+#include "renderer.h"
+#include "task_pool.h"
+
+// Reference implementation of BuddhabrotRenderer's accumulation pass on the CPU.
+// It computes the same importance map and splats orbits the same way, with
+// samples drawn from the same distribution but not the same sequence (Gaussian
+// offsets are seeded per task range), so its histogram is a statistically
+// equivalent estimate to compare the GPU engines against.
+class BuddhabrotCPURenderer
+{
+  public:
+    // The task pool is shared, not owned, and must outlive the renderer
+    BuddhabrotCPURenderer(const BuddhabrotRendererOptions &options, TaskPool &pool);
+
+    void render();
+    void setSeed(int seed);
+    // Sample from a seed database (not owned) while the orbit parameters match it
+    void setSeedDatabase(SeedDatabase *seeds) { this->seeds = seeds; }
+    bool isUsingSeeds() { return usingSeeds; }
+
+    // Binned splatting (default) buffers orbit points per worker thread and per
+    // tile, then flushes a whole bin into one cache-resident tile of 32-bit
+    // fixed-point counters. The scattered path writes every point straight into
+    // the float histogram and is kept for comparison.
+    void setBinnedSplatting(bool binned) { this->binned = binned; }
+
+    // renderSize x renderSize RGB bands, laid out like the GPU accumulation texture
+    const float *getHistogram();
+    int getSamplesCount() { return samplesCount; }
+    long long getPointsCount() { return pointsCount; }
+    // Wall time of the last render() without the importance pass: sampling,
+    // splatting and the final bin flush
+    double getAccumulateSeconds() { return accumulateSeconds; }
+    // Memory of one worker's bins, keys and amounts for every tile
+    size_t getBinBytes() { return (size_t)tilesX * tilesX * BinCapacity * 2 * sizeof(uint32_t); }
+
+    ~BuddhabrotCPURenderer();
+
+    // Tiles are TileSize x TileSize pixels with 3 counters each (48 KB)
+    static const int TileShift = 6;
+    static const int TileSize = 1 << TileShift;
+    static const int BinCapacity = 128;
+    // Fixed-point scale of the counters, weights are stochastically rounded
+    static const int CounterScale = 4096;
+
+  private:
+    struct Worker;
+
+    void renderImportance();
+    void createWorkers();
+    // One parallelFor per frame, each task samples and splats its own range
+    void accumulateCells(const FractalTransform &transform);
+    void accumulateSeeds(const FractalTransform &transform);
+    void accumulateScattered(const FractalTransform &transform, const float *samples, int count);
+    void accumulateBinned(Worker &worker, const FractalTransform &transform, const float *samples, int count);
+    void flushBin(Worker &worker, int tile);
+    // Adaptive importance learns from the orbits actually drawn: each worker
+    // counts visible points per importance cell, and after the frame their
+    // means become the sampler's contribution buffer for the next one
+    void countVisible(Worker &worker, float cx, float cy, long long visible);
+    void updateContribution();
+
+    BuddhabrotRendererOptions options;
+    int mipmapSize;
+    std::vector<unsigned char> escapes;
+    std::vector<float> histogram;
+    bool histogramResolved;
+    bool adaptive;
+    int symmetry;
+    int samplesCount;
+    long long pointsCount;
+    double accumulateSeconds;
+    sampler_t *sampler;
+    SeedDatabase *seeds;
+    bool usingSeeds;
+    std::vector<float> seedChunk;
+
+    bool binned;
+    TaskPool *pool;
+    int tilesX;
+    std::vector<uint32_t> counters;
+    std::atomic_flag *tileLocks;
+    std::vector<Worker *> workers;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "fractal.h"
 #include <math.h>
+#include <sstream>
 #include "opengl.h"
 
 #define DEG2RAD (0.01745329252f)
@@ -31,12 +32,12 @@ std::string BuddhabrotFractal::getShaderFunction()
         )_CODE_";
 }
 
-void shader_uniform_matrix(GLuint shader, const char *name, float theta, float scaler, float yscale)
+void fractal_matrix(float *matrix, float theta, float scaler, float yscale)
 {
-    float matrix[] = {
-        cos(theta * DEG2RAD) * scaler, sin(theta * DEG2RAD) * scaler * yscale,
-        -sin(theta * DEG2RAD) * scaler, cos(theta * DEG2RAD) * scaler * yscale};
-    glUniformMatrix2fv(glGetUniformLocation(shader, name), 1, GL_FALSE, matrix);
+    matrix[0] = cos(theta * DEG2RAD) * scaler;
+    matrix[1] = sin(theta * DEG2RAD) * scaler * yscale;
+    matrix[2] = -sin(theta * DEG2RAD) * scaler;
+    matrix[3] = cos(theta * DEG2RAD) * scaler * yscale;
 }
 
 void rotation4d(float angle, int i1, int i2, float *input, float *output)
@@ -58,13 +59,36 @@ void rotation4d(float angle, int i1, int i2, float *input, float *output)
     }
 }
 
-void BuddhabrotFractal::setShaderUniforms(GLuint shader)
+int FractalTransform::getSymmetry() const
 {
-    shader_uniform_matrix(shader, "fractal_z1_scaler", parameters.z1_angle, parameters.z1_scaler, parameters.z1_yscale);
-    shader_uniform_matrix(shader, "fractal_z2_scaler", parameters.z2_angle, parameters.z2_scaler, parameters.z2_yscale);
-    shader_uniform_matrix(shader, "fractal_z3_scaler", parameters.z3_angle, parameters.z3_scaler, parameters.z3_yscale);
-    float e1[] = {1, 0, 0, 0};
-    float e2[] = {0, 1, 0, 0};
+    const float eps = 1e-6f;
+    const float *matrices[] = {z1, z2, z3};
+    for (const float *m : matrices)
+    {
+        if (fabs(m[1]) > eps || fabs(m[2]) > eps)
+            return FRACTAL_SYMMETRY_NONE;
+    }
+    bool e1Real = fabs(e1[1]) <= eps && fabs(e1[3]) <= eps;
+    bool e1Imag = fabs(e1[0]) <= eps && fabs(e1[2]) <= eps;
+    bool e2Real = fabs(e2[1]) <= eps && fabs(e2[3]) <= eps;
+    bool e2Imag = fabs(e2[0]) <= eps && fabs(e2[2]) <= eps;
+    if (e1Real && e2Imag)
+        return FRACTAL_SYMMETRY_MIRROR_Y;
+    if (e1Imag && e2Real)
+        return FRACTAL_SYMMETRY_MIRROR_X;
+    return FRACTAL_SYMMETRY_NONE;
+}
+
+FractalTransform BuddhabrotFractal::getTransform()
+{
+    FractalTransform t;
+    fractal_matrix(t.z1, parameters.z1_angle, parameters.z1_scaler, parameters.z1_yscale);
+    fractal_matrix(t.z2, parameters.z2_angle, parameters.z2_scaler, parameters.z2_yscale);
+    fractal_matrix(t.z3, parameters.z3_angle, parameters.z3_scaler, parameters.z3_yscale);
+    float *e1 = t.e1;
+    float *e2 = t.e2;
+    e1[0] = 1, e1[1] = 0, e1[2] = 0, e1[3] = 0;
+    e2[0] = 0, e2[1] = 1, e2[2] = 0, e2[3] = 0;
 
     rotation4d(parameters.rotation_zxcx, 0, 2, e1, e1);
     rotation4d(parameters.rotation_zxcx, 0, 2, e2, e2);
@@ -74,9 +98,60 @@ void BuddhabrotFractal::setShaderUniforms(GLuint shader)
     rotation4d(parameters.rotation_zycx, 1, 2, e2, e2);
     rotation4d(parameters.rotation_zycy, 1, 3, e1, e1);
     rotation4d(parameters.rotation_zycy, 1, 3, e2, e2);
+    return t;
+}
+
+void BuddhabrotFractal::setShaderUniforms(GLuint shader)
+{
+    FractalTransform t = getTransform();
+    glUniformMatrix2fv(glGetUniformLocation(shader, "fractal_z1_scaler"), 1, GL_FALSE, t.z1);
+    glUniformMatrix2fv(glGetUniformLocation(shader, "fractal_z2_scaler"), 1, GL_FALSE, t.z2);
+    glUniformMatrix2fv(glGetUniformLocation(shader, "fractal_z3_scaler"), 1, GL_FALSE, t.z3);
+    glUniform4fv(glGetUniformLocation(shader, "fractal_rotation_e1"), 1, t.e1);
+    glUniform4fv(glGetUniformLocation(shader, "fractal_rotation_e2"), 1, t.e2);
+}
+
+std::string BuddhabrotFractal::getOrbitKey(float tolerance)
+{
+    float values[] = {
+        parameters.z3_scaler, parameters.z3_angle, parameters.z3_yscale,
+        parameters.z2_scaler, parameters.z2_angle, parameters.z2_yscale,
+        parameters.z1_scaler, parameters.z1_angle, parameters.z1_yscale};
+    std::ostringstream key;
+    for (int i = 0; i < 9; i++)
+        key << (long long)floor(values[i] / tolerance + 0.5) << ",";
+    return key.str();
+}
 
-    glUniform4fv(glGetUniformLocation(shader, "fractal_rotation_e1"), 1, e1);
-    glUniform4fv(glGetUniformLocation(shader, "fractal_rotation_e2"), 1, e2);
+bool BuddhabrotFractal::BuddhabrotFractalParameters::set(const std::string &name, float value)
+{
+    struct
+    {
+        const char *name;
+        float BuddhabrotFractalParameters::*field;
+    } fields[] = {
+        {"z3_scaler", &BuddhabrotFractalParameters::z3_scaler},
+        {"z3_angle", &BuddhabrotFractalParameters::z3_angle},
+        {"z3_yscale", &BuddhabrotFractalParameters::z3_yscale},
+        {"z2_scaler", &BuddhabrotFractalParameters::z2_scaler},
+        {"z2_angle", &BuddhabrotFractalParameters::z2_angle},
+        {"z2_yscale", &BuddhabrotFractalParameters::z2_yscale},
+        {"z1_scaler", &BuddhabrotFractalParameters::z1_scaler},
+        {"z1_angle", &BuddhabrotFractalParameters::z1_angle},
+        {"z1_yscale", &BuddhabrotFractalParameters::z1_yscale},
+        {"rotation_zxcx", &BuddhabrotFractalParameters::rotation_zxcx},
+        {"rotation_zxcy", &BuddhabrotFractalParameters::rotation_zxcy},
+        {"rotation_zycx", &BuddhabrotFractalParameters::rotation_zycx},
+        {"rotation_zycy", &BuddhabrotFractalParameters::rotation_zycy}};
+    for (auto &f : fields)
+    {
+        if (name == f.name)
+        {
+            this->*f.field = value;
+            return true;
+        }
+    }
+    return false;
 }
 
 BuddhabrotFractal *Fractal::CreateBuddhabrot()
@@ -1,14 +1,100 @@
 #ifndef BUDDHABROT_RENDERER_FRACTAL_H
 #define BUDDHABROT_RENDERER_FRACTAL_H
 
+#include <math.h>
 #include <string>
 #include "opengl.h"
 
+// Mirror symmetry of the projected image, see FractalTransform::getSymmetry
+#define FRACTAL_SYMMETRY_NONE 0
+#define FRACTAL_SYMMETRY_MIRROR_X 1 // image(x, y) == image(-x, y)
+#define FRACTAL_SYMMETRY_MIRROR_Y 2 // image(x, y) == image(x, -y)
+
+// The fractal resolved into the matrices used by the shaders, for the CPU paths.
+// Matrices are column-major like GLSL mat2, the projection rows act on (z, c).
+struct FractalTransform
+{
+    float z3[4], z2[4], z1[4];
+    float e1[4], e2[4];
+
+    // One step of fractal() from the shader function
+    inline void iterate(float &zx, float &zy, float cx, float cy) const
+    {
+        float xx = zx * zx;
+        float yy = zy * zy;
+        float z2x = xx - yy, z2y = zx * zy * 2.0f;
+        float z3x = xx * zx - 3.0f * zx * yy, z3y = 3.0f * xx * zy - yy * zy;
+        float rx = z3[0] * z3x + z3[2] * z3y + z2[0] * z2x + z2[2] * z2y + z1[0] * zx + z1[2] * zy + cx;
+        float ry = z3[1] * z3x + z3[3] * z3y + z2[1] * z2x + z2[3] * z2y + z1[1] * zx + z1[3] * zy + cy;
+        zx = rx;
+        zy = ry;
+    }
+
+    // fractal_projection() from the shader function
+    inline void project(float zx, float zy, float cx, float cy, float &px, float &py) const
+    {
+        px = e1[0] * zx + e1[1] * zy + e1[2] * cx + e1[3] * cy;
+        py = e2[0] * zx + e2[1] * zy + e2[2] * cx + e2[3] * cy;
+    }
+
+    // The importance shader's test of one c: the escape iteration, 0 below 16 or
+    // without escape and at most 255, and in visible the orbit points inside the
+    // render target (0 without escape)
+    inline int importanceEscape(float cx, float cy, int maxIterations, int &visible) const
+    {
+        float zx = 0, zy = 0;
+        bool escaped = false;
+        int i;
+        visible = 0;
+        for (i = 0; i <= maxIterations; i++)
+        {
+            float z1x = zx, z1y = zy;
+            iterate(z1x, z1y, cx, cy);
+            if (zx == z1x && zy == z1y)
+            {
+                i = maxIterations;
+                break;
+            }
+            zx = z1x;
+            zy = z1y;
+            if (zx * zx + zy * zy > 16.0f)
+            {
+                escaped = true;
+                break;
+            }
+            float qx, qy;
+            project(zx, zy, cx, cy, qx, qy);
+            if (i >= 1 && fabsf(qx / 2.0f) <= 1.0f && fabsf(qy / 2.0f) <= 1.0f)
+                visible++;
+        }
+        if (!escaped)
+        {
+            visible = 0;
+            return 0;
+        }
+        if (i >= 256)
+            visible = 0;
+        visible = visible > 255 ? 255 : visible;
+        int v = i >= 16 ? i : 0;
+        return v > 255 ? 255 : v;
+    }
+
+    // If all matrices are diagonal the orbit map commutes with conjugation,
+    // f(conj z, conj c) = conj f(z, c). When additionally one projection row only
+    // reads real parts and the other only imaginary parts, conjugation becomes a
+    // mirror of the image, so half of the c plane suffices.
+    int getSymmetry() const;
+};
+
 class Fractal
 {
   public:
     virtual std::string getShaderFunction() = 0;
     virtual void setShaderUniforms(GLuint shader) = 0;
+    virtual FractalTransform getTransform() = 0;
+    // Parameters that determine the orbits, quantized to tolerance, for caching;
+    // the projection rotations are not part of it
+    virtual std::string getOrbitKey(float tolerance) = 0;
     virtual ~Fractal() {}
 
     static class BuddhabrotFractal *CreateBuddhabrot();
@@ -43,6 +129,9 @@ class BuddhabrotFractal : public Fractal
             rotation_zycx = 0;
             rotation_zycy = 0;
         }
+
+        // Set a field by its name as used in the presets, returns false if unknown
+        bool set(const std::string &name, float value);
     };
 
     BuddhabrotFractalParameters parameters;
@@ -50,6 +139,8 @@ class BuddhabrotFractal : public Fractal
     BuddhabrotFractal();
     virtual std::string getShaderFunction();
     virtual void setShaderUniforms(GLuint shader);
+    virtual FractalTransform getTransform();
+    virtual std::string getOrbitKey(float tolerance);
 };
 
 #endif
\ No newline at end of file
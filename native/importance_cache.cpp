@@ -0,0 +1,43 @@
+#include "importance_cache.h"
+
+ImportanceCache::ImportanceCache(size_t _maxBytes) : maxBytes(_maxBytes)
+{
+    bytes = 0;
+    hits = 0;
+    misses = 0;
+}
+
+const std::vector<unsigned char> *ImportanceCache::find(const std::string &key)
+{
+    auto it = index.find(key);
+    if (it == index.end())
+    {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->second;
+}
+
+void ImportanceCache::insert(const std::string &key, const std::vector<unsigned char> &data)
+{
+    auto it = index.find(key);
+    if (it != index.end())
+    {
+        bytes -= it->second->second.size();
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    if (data.size() > maxBytes)
+        return;
+    entries.push_front(std::make_pair(key, data));
+    index[key] = entries.begin();
+    bytes += data.size();
+    while (bytes > maxBytes)
+    {
+        bytes -= entries.back().second.size();
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
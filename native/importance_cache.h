@@ -0,0 +1,37 @@
+#ifndef BUDDHABROT_RENDERER_IMPORTANCE_CACHE_H
+#define BUDDHABROT_RENDERER_IMPORTANCE_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// LRU cache of importance buffers read back from the sampler's map pass, keyed by
+// the quantized orbit-relevant fractal parameters. Switching back to a recent
+// preset then skips the map pass and its glGetTexImage.
+class ImportanceCache
+{
+  public:
+    ImportanceCache(size_t maxBytes);
+
+    // The cached buffer for key, or nullptr on a miss; a hit becomes most recent
+    const std::vector<unsigned char> *find(const std::string &key);
+    // Insert or replace, evicting least recently used entries beyond the memory cap
+    void insert(const std::string &key, const std::vector<unsigned char> &data);
+
+    long long getHits() { return hits; }
+    long long getMisses() { return misses; }
+    size_t getBytes() { return bytes; }
+    size_t getEntries() { return entries.size(); }
+
+  private:
+    typedef std::list<std::pair<std::string, std::vector<unsigned char>>> EntryList;
+    EntryList entries;
+    std::map<std::string, EntryList::iterator> index;
+    size_t maxBytes;
+    size_t bytes;
+    long long hits;
+    long long misses;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <math.h>
 #include <mutex>
+#include <stdlib.h>
+#include <string>
 #include <vector>
 
 #ifndef WIN32
@@ -13,6 +15,8 @@
 #include "opengl.h"
 #include "renderer.h"
 #include "fractal.h"
+#include "video_output.h"
+#include "render_server.h"
 
 GLFWwindow *window;
 
@@ -64,6 +68,9 @@ class FPSCounter
 
 FPSCounter fps;
 
+// Region of the last frame, for video output
+int viewportX, viewportY, viewportSize;
+
 void render()
 {
     fps.frame();
@@ -85,25 +92,95 @@ void render()
 
     if (width < height)
     {
-        renderer->render(0, (height - width) >> 1, width, width);
+        viewportX = 0, viewportY = (height - width) >> 1, viewportSize = width;
     }
     else
     {
-        renderer->render((width - height) >> 1, 0, height, height);
+        viewportX = (width - height) >> 1, viewportY = 0, viewportSize = height;
     }
+    renderer->render(viewportX, viewportY, viewportSize, viewportSize);
 }
 
+// Usage: ./renderer [--output FILE | --output - | --output "|ffmpeg ..."]
+//                   [--format y4m|raw] [--fps N] [--frames N] [--engine geometry|compute]
+//                   [--accumulator rgba32f|rgb16f|r32ui] [--seeds FILE]
+//                   [--jitter gaussian|r2|sobol] [--normalize fixed|max] [--adaptive] [--verbose]
+//        ./renderer --serve SOCKET
+//            renders requests from a Unix socket off-screen, in a hidden window that
+//            still needs a display (see render_server.h)
 int main(int argc, char *argv[])
 {
+    std::string servePath;
+    std::string seedsPath;
+    std::string videoTarget;
+    VideoOutput::Format videoFormat = VideoOutput::FormatY4M;
+    int videoFPS = 30;
+    int videoFrames = 0;
+    int engine = BUDDHABROT_ENGINE_GEOMETRY;
+    int accumulator = BUDDHABROT_ACCUMULATOR_RGBA32F;
+    int jitter = SAMPLER_JITTER_GAUSSIAN;
+    bool verbose = false;
+    bool adaptive = false;
+    bool normalizeMax = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--verbose")
+        {
+            verbose = true;
+            continue;
+        }
+        if (arg == "--adaptive")
+        {
+            adaptive = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            break;
+        std::string value = argv[++i];
+        if (arg == "--output")
+            videoTarget = value;
+        else if (arg == "--format")
+            videoFormat = value == "raw" ? VideoOutput::FormatRaw : VideoOutput::FormatY4M;
+        else if (arg == "--fps")
+            videoFPS = atoi(value.c_str());
+        else if (arg == "--frames")
+            videoFrames = atoi(value.c_str());
+        else if (arg == "--engine")
+            engine = value == "compute" ? BUDDHABROT_ENGINE_COMPUTE : BUDDHABROT_ENGINE_GEOMETRY;
+        else if (arg == "--accumulator")
+            accumulator = value == "r32ui" ? BUDDHABROT_ACCUMULATOR_R32UI
+                                           : (value == "rgb16f" ? BUDDHABROT_ACCUMULATOR_RGB16F : BUDDHABROT_ACCUMULATOR_RGBA32F);
+        else if (arg == "--jitter")
+            jitter = value == "sobol" ? SAMPLER_JITTER_SOBOL : (value == "r2" ? SAMPLER_JITTER_R2 : SAMPLER_JITTER_GAUSSIAN);
+        else if (arg == "--normalize")
+            normalizeMax = value == "max";
+        else if (arg == "--seeds")
+            seedsPath = value;
+        else if (arg == "--serve")
+            servePath = value;
+    }
+
     glfwInit();
 
+    // Compute shaders and image atomics need a 4.x context
+    bool modern = engine == BUDDHABROT_ENGINE_COMPUTE || accumulator == BUDDHABROT_ACCUMULATOR_R32UI;
     glfwDefaultWindowHints();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, modern ? 4 : 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (!servePath.empty())
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
 
     window = glfwCreateWindow(800, 800, "Buddhabrot Renderer", nullptr, nullptr);
+    if (window == nullptr && modern)
+    {
+        // No 4.3 context (e.g. macOS stops at 4.1), the renderer falls back to the geometry engine
+        // and the RGBA32F accumulator
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(800, 800, "Buddhabrot Renderer", nullptr, nullptr);
+    }
 
     glfwMakeContextCurrent(window);
 
@@ -114,13 +191,38 @@ int main(int argc, char *argv[])
     options.samplerMipmapLevel = 1;
     options.samplerMaxIterations = 256;
     options.samplerLowerBound = 100000;
+    options.samplerChunkSize = 65536;
+    options.samplerJitter = jitter;
+    options.exploitSymmetry = true;
+    // Adaptive importance renders the importance map every frame, bypassing the cache
+    options.samplerAdaptiveLevels = adaptive ? 3 : 0;
+    options.samplerAdaptiveStrength = 0.75;
+    options.importanceCacheBytes = 64 << 20;
+    options.importanceCacheTolerance = 1e-3f;
+    options.samplerSeedDatabase = seedsPath.empty() ? nullptr : seedsPath.c_str();
     options.renderSize = 2048;
     options.renderIterations = 64;
+    options.engine = engine;
+    options.accumulator = accumulator;
+
+    if (!servePath.empty())
+    {
+        // Requests jump between unrelated parameters, so there is no earlier
+        // frame for adaptive importance to learn from
+        options.samplerAdaptiveLevels = 0;
+        RenderServer server(servePath, options);
+        if (!server.isOpen())
+            return 1;
+        std::cerr << "render server: listening on " << servePath << std::endl;
+        server.run();
+        return 0;
+    }
 
     fractal = Fractal::CreateBuddhabrot();
     options.fractal = fractal;
 
     renderer = new BuddhabrotRenderer(options);
+    renderer->setNormalizeMax(normalizeMax);
 
     lo::ServerThread st(9000);
     st.add_method("buddhabrot_parameters", "fffffffffffff", [](lo_arg **argv, int) {
@@ -154,13 +256,54 @@ int main(int argc, char *argv[])
     });
     st.start();
 
+    VideoOutput *video = nullptr;
+    if (!videoTarget.empty())
+    {
+        // Frame size is fixed when recording starts, keep the window size constant
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        int size = width < height ? width : height;
+        video = new VideoOutput(videoTarget, size, size, videoFPS, videoFormat);
+    }
+
+    double renderTime = 0;
+    int frames = 0;
     while (!glfwWindowShouldClose(window))
     {
+        double t0 = glfwGetTime();
         render();
+        renderTime += glfwGetTime() - t0;
+        frames++;
+        if (verbose && frames % 100 == 0)
+        {
+            // Only meaningful without adaptive importance, which bypasses the cache
+            ImportanceCache &cache = renderer->getSampler().getCache();
+            std::cerr << "importance cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses, "
+                      << cache.getEntries() << " entries, " << cache.getBytes() / 1024 << " KB" << std::endl;
+        }
+        if (video)
+        {
+            video->addFrame(viewportX, viewportY);
+            if (frames % 100 == 0)
+            {
+                std::cerr << "video: " << video->getFramesWritten() << " frames written, render "
+                          << renderTime / frames * 1000 << " ms/frame, readback stall "
+                          << video->getReadbackStall() / frames * 1000 << " ms/frame, encode stall "
+                          << video->getEncodeStall() / frames * 1000 << " ms/frame, writer "
+                          << video->getWriterTime() / frames * 1000 << " ms/frame" << std::endl;
+            }
+            if (videoFrames > 0 && frames >= videoFrames)
+                break;
+        }
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    if (video)
+    {
+        video->finish();
+        delete video;
+    }
     delete renderer;
 
     return 0;
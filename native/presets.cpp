@@ -0,0 +1,42 @@
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+
+#include "presets.h"
+
+// Only the flat "parameters": { "name": number, ... } objects are read, the rest
+// of the file (embedded thumbnails etc.) is skipped.
+std::vector<BuddhabrotFractal::BuddhabrotFractalParameters> load_presets(const std::string &path)
+{
+    std::vector<BuddhabrotFractal::BuddhabrotFractalParameters> result;
+    std::ifstream file(path.c_str());
+    if (!file)
+        return result;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string text = stream.str();
+
+    size_t pos = 0;
+    while ((pos = text.find("\"parameters\"", pos)) != std::string::npos)
+    {
+        size_t begin = text.find('{', pos);
+        size_t end = text.find('}', begin);
+        if (begin == std::string::npos || end == std::string::npos)
+            break;
+        BuddhabrotFractal::BuddhabrotFractalParameters parameters;
+        size_t p = begin;
+        while ((p = text.find('"', p + 1)) < end)
+        {
+            size_t name_end = text.find('"', p + 1);
+            size_t colon = text.find(':', name_end);
+            if (name_end >= end || colon >= end)
+                break;
+            std::string name = text.substr(p + 1, name_end - p - 1);
+            parameters.set(name, (float)strtod(text.c_str() + colon + 1, nullptr));
+            p = name_end;
+        }
+        result.push_back(parameters);
+        pos = end;
+    }
+    return result;
+}
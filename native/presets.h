@@ -0,0 +1,12 @@
+#ifndef BUDDHABROT_RENDERER_PRESETS_H
+#define BUDDHABROT_RENDERER_PRESETS_H
+
+#include <string>
+#include <vector>
+#include "fractal.h"
+
+// Load the "parameters" objects from an animation file such as data/animations.json
+// or native/animation-*.json. Returns an empty list if the file cannot be read.
+std::vector<BuddhabrotFractal::BuddhabrotFractalParameters> load_presets(const std::string &path);
+
+#endif
@@ -0,0 +1,759 @@
+// Image quality regression harness.
+//
+// Renders parameter presets to a high-sample reference histogram per sampler
+// jitter with the CPU engine, then renders each sampler/engine configuration at
+// a range of sample budgets and reports error against sample count and wall
+// time. Variance is measured against the reference of the configuration's own
+// jitter, and bias (relative difference of the totals) against the mean of the
+// gaussian, r2 and sobol references. The figure of merit per configuration is
+// the efficiency 1 / (relative MSE * seconds), which for a Monte Carlo
+// estimator is independent of the budget; a drop below the baseline beyond the
+// tolerance fails the run. The baseline also keeps each configuration's bias and
+// the total of every preset's mean reference, so a change that biases all
+// samplers or the splat kernel alike fails against --bias-tolerance.
+//
+// Usage: ./quality [--size N] [--sampler-size N] [--budgets a,b,c] [--reference N]
+//                  [--presets N] [--gpu] [--symmetry] [--adaptive] [--seeds RESOLUTION] [--csv FILE]
+//                  [--baseline FILE] [--write-baseline FILE] [--tolerance X] [--bias-tolerance X]
+//                  [--threads N] [--pin]
+//                  [preset.json ...]
+//        ./quality [--threads N] [--pin] --splat-benchmark
+//            compares binned and scattered CPU splatting on one thread at 2048 and
+//            4096 with the bin memory, then reports thread scaling of the binned
+//            path with per-worker task stats; only the accumulation is timed
+//        ./quality [--reference N] --engine-benchmark
+//            compares orbit points per second of the GPU geometry and compute engines
+//        ./quality [--reference N] --accumulator-benchmark
+//            compares memory, accumulate and display time of the GPU accumulator
+//            formats at 2048 and 4096, and their histograms against RGBA32F
+//
+// --seeds adds "cpu seeds", which samples from a seed database of 4 generations
+// built per preset at the given grid resolution instead of the importance map.
+//
+// With --gpu the OpenGL engines are added: "gpu" (geometry shader) and, given
+// an OpenGL 4.3 context, "gpu-compute". Under Mesa, LIBGL_ALWAYS_SOFTWARE=1
+// runs both on the llvmpipe software rasterizer.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <math.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opengl.h"
+#include "cpu_renderer.h"
+#include "presets.h"
+#include "renderer.h"
+#include "seed_database.h"
+
+struct QualityConfig
+{
+    std::string engine;
+    int jitter;
+};
+
+// QualityConfig::jitter of the seed database configuration
+#define QUALITY_SEEDS -1
+
+const char *jitter_name(int jitter)
+{
+    switch (jitter)
+    {
+    case SAMPLER_JITTER_R2:
+        return "r2";
+    case SAMPLER_JITTER_SOBOL:
+        return "sobol";
+    case QUALITY_SEEDS:
+        return "seeds";
+    default:
+        return "gaussian";
+    }
+}
+
+// CPU engine task pool settings, 0 threads uses all hardware threads
+int cpuThreads = 0;
+bool pinThreads = false;
+
+// One pool for every CPU render and the seed generation, created on first use
+// once the command line has set the thread count
+TaskPool &cpu_pool()
+{
+    static TaskPool pool(cpuThreads, pinThreads);
+    return pool;
+}
+
+// Database of the current preset for the QUALITY_SEEDS configuration
+SeedDatabase *seeds = nullptr;
+
+double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Renderer options shared by the benchmarks and the quality runs: geometry
+// engine, RGBA32F target, no symmetry, adaptive importance, cache or seed database
+BuddhabrotRendererOptions make_options(BuddhabrotFractal *fractal, int samplerSize, int renderSize, int budget, int jitter)
+{
+    BuddhabrotRendererOptions options;
+    options.samplerSize = samplerSize;
+    options.samplerMipmapLevel = 1;
+    options.samplerMaxIterations = 256;
+    options.samplerLowerBound = budget;
+    options.samplerChunkSize = 65536;
+    options.samplerJitter = jitter;
+    options.exploitSymmetry = false;
+    options.samplerAdaptiveLevels = 0;
+    options.samplerAdaptiveStrength = 0;
+    options.importanceCacheBytes = 0;
+    options.importanceCacheTolerance = 1e-3f;
+    options.samplerSeedDatabase = nullptr;
+    options.renderSize = renderSize;
+    options.renderIterations = 64;
+    options.engine = BUDDHABROT_ENGINE_GEOMETRY;
+    options.accumulator = BUDDHABROT_ACCUMULATOR_RGBA32F;
+    options.fractal = fractal;
+    return options;
+}
+
+// Render one histogram with the given engine, returns wall time in seconds
+double render_histogram(const QualityConfig &config, const BuddhabrotRendererOptions &options, int seed, std::vector<float> &output, int &samplesCount)
+{
+    output.resize(options.renderSize * options.renderSize * 3);
+    if (config.engine == "gpu" || config.engine == "gpu-compute")
+    {
+        BuddhabrotRendererOptions engineOptions = options;
+        engineOptions.engine = config.engine == "gpu" ? BUDDHABROT_ENGINE_GEOMETRY : BUDDHABROT_ENGINE_COMPUTE;
+        BuddhabrotRenderer renderer(engineOptions);
+        glFinish();
+        double t0 = now();
+        renderer.accumulate();
+        glFinish();
+        double t1 = now();
+        renderer.readHistogram(&output[0]);
+        samplesCount = renderer.getSamplesCount();
+        return t1 - t0;
+    }
+    BuddhabrotRendererOptions cpuOptions = options;
+    if (config.jitter == QUALITY_SEEDS)
+        cpuOptions.samplerJitter = SAMPLER_JITTER_SOBOL;
+    BuddhabrotCPURenderer renderer(cpuOptions, cpu_pool());
+    renderer.setSeed(seed);
+    if (config.jitter == QUALITY_SEEDS)
+    {
+        seeds->setSeed(seed);
+        renderer.setSeedDatabase(seeds);
+    }
+    // Adaptive importance learns from the orbits of earlier frames, give it one
+    if (options.samplerAdaptiveLevels > 0)
+        renderer.render();
+    double t0 = now();
+    renderer.render();
+    double t1 = now();
+    const float *histogram = renderer.getHistogram();
+    output.assign(histogram, histogram + output.size());
+    samplesCount = renderer.getSamplesCount();
+    return t1 - t0;
+}
+
+// Throughput of the CPU accumulator's binned splatting vs. naive scattered
+// writes, both on one thread so only memory locality differs, then the thread
+// scaling of the binned path. Only the accumulation is timed, not the
+// importance pass.
+int splat_benchmark(int budget)
+{
+    BuddhabrotFractal *fractal = Fractal::CreateBuddhabrot();
+    BuddhabrotRendererOptions options = make_options(fractal, 512, 2048, budget, SAMPLER_JITTER_R2);
+    std::cerr << "size  splatting   seconds   Mpoints/s   bin MB per worker" << std::endl;
+    TaskPool singlePool(1, pinThreads);
+    for (int size : {2048, 4096})
+    {
+        options.renderSize = size;
+        for (bool binned : {false, true})
+        {
+            BuddhabrotCPURenderer renderer(options, singlePool);
+            renderer.setBinnedSplatting(binned);
+            renderer.render(); // warm up
+            renderer.render();
+            double seconds = renderer.getAccumulateSeconds();
+            std::cerr << size << "  " << (binned ? "binned   " : "scattered") << "  " << seconds << "  "
+                      << renderer.getPointsCount() / seconds / 1e6 << "  "
+                      << (binned ? renderer.getBinBytes() / 1048576.0 : 0) << std::endl;
+        }
+    }
+
+    // Binned splatting at 2048 with 1, 2, 4, ... threads up to the pool size
+    options.renderSize = 2048;
+    int maxThreads = cpuThreads > 0 ? cpuThreads : (int)std::thread::hardware_concurrency();
+    double single = 0;
+    std::cerr << std::endl << "threads   seconds   Mpoints/s   speedup   bin MB" << std::endl;
+    for (int threads = 1;; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads)
+    {
+        TaskPool pool(threads, pinThreads);
+        BuddhabrotCPURenderer renderer(options, pool);
+        renderer.render();
+        pool.resetStats();
+        renderer.render();
+        double seconds = renderer.getAccumulateSeconds();
+        if (threads == 1)
+            single = seconds;
+        std::cerr << threads << "  " << seconds << "  " << renderer.getPointsCount() / seconds / 1e6 << "  "
+                  << single / seconds << "  " << renderer.getBinBytes() * threads / 1048576.0 << std::endl;
+        if (threads >= maxThreads)
+        {
+            pool.printStats(std::cerr);
+            break;
+        }
+    }
+    delete fractal;
+    return 0;
+}
+
+// GPU time and orbit points per second of the geometry shader and compute engines
+int engine_benchmark(int budget, bool compute)
+{
+    BuddhabrotFractal *fractal = Fractal::CreateBuddhabrot();
+    BuddhabrotRendererOptions options = make_options(fractal, 512, 2048, budget, SAMPLER_JITTER_R2);
+    if (!compute)
+        std::cerr << "no OpenGL 4.3 context, compute engine skipped" << std::endl;
+    std::cerr << "size  engine     gpu seconds   Mpoints/s" << std::endl;
+    for (int size : {1024, 2048})
+    {
+        options.renderSize = size;
+        for (int engine : {BUDDHABROT_ENGINE_GEOMETRY, BUDDHABROT_ENGINE_COMPUTE})
+        {
+            if (engine == BUDDHABROT_ENGINE_COMPUTE && !compute)
+                continue;
+            options.engine = engine;
+            BuddhabrotRenderer renderer(options);
+            renderer.setProfiling(true);
+            renderer.accumulate(); // warm up
+            renderer.accumulate();
+            double seconds = renderer.getAccumulateSeconds();
+            std::cerr << size << "  " << (engine == BUDDHABROT_ENGINE_COMPUTE ? "compute " : "geometry") << "  " << seconds
+                      << "  " << renderer.getPointsCount() / seconds / 1e6 << std::endl;
+        }
+    }
+    delete fractal;
+    return 0;
+}
+
+const char *accumulator_name(int accumulator)
+{
+    switch (accumulator)
+    {
+    case BUDDHABROT_ACCUMULATOR_RGB16F:
+        return "rgb16f ";
+    case BUDDHABROT_ACCUMULATOR_R32UI:
+        return "r32ui  ";
+    default:
+        return "rgba32f";
+    }
+}
+
+// Memory, time of accumulate() and display() into a 1024 x 1024 target, with the
+// fixed scale and with max normalization, and
+// relative RMS difference to the RGBA32F histogram of each accumulator format;
+// timed on the wall clock to the end of the GPU work
+int accumulator_benchmark(int budget, bool compute)
+{
+    BuddhabrotFractal *fractal = Fractal::CreateBuddhabrot();
+    BuddhabrotRendererOptions options = make_options(fractal, 512, 2048, budget, SAMPLER_JITTER_R2);
+
+    const int displaySize = 1024;
+    GLuint displayTexture, displayFramebuffer;
+    glGenTextures(1, &displayTexture);
+    glBindTexture(GL_TEXTURE_2D, displayTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, displaySize, displaySize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &displayFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, displayFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, displayTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!compute)
+        std::cerr << "no OpenGL 4.3 context, compute engine skipped" << std::endl;
+    std::cerr << "size  engine    accumulator  MB   accumulate s   display s   display max s   frame s   rel. difference"
+              << std::endl;
+    std::vector<float> reference, histogram;
+    for (int size : {2048, 4096})
+    {
+        options.renderSize = size;
+        for (int engine : {BUDDHABROT_ENGINE_GEOMETRY, BUDDHABROT_ENGINE_COMPUTE})
+        {
+            if (engine == BUDDHABROT_ENGINE_COMPUTE && !compute)
+                continue;
+            options.engine = engine;
+            double referenceSquares = 0;
+            for (int accumulator : {BUDDHABROT_ACCUMULATOR_RGBA32F, BUDDHABROT_ACCUMULATOR_RGB16F, BUDDHABROT_ACCUMULATOR_R32UI})
+            {
+                options.accumulator = accumulator;
+                BuddhabrotRenderer renderer(options);
+                glBindFramebuffer(GL_FRAMEBUFFER, displayFramebuffer);
+                renderer.render(0, 0, displaySize, displaySize); // warm up
+                glFinish();
+                double t0 = now();
+                renderer.accumulate();
+                glFinish();
+                double t1 = now();
+                glBindFramebuffer(GL_FRAMEBUFFER, displayFramebuffer);
+                renderer.display(0, 0, displaySize, displaySize);
+                glFinish();
+                double t2 = now();
+                renderer.setNormalizeMax(true);
+                renderer.display(0, 0, displaySize, displaySize); // allocates the reduction levels
+                glFinish();
+                double t3 = now();
+                renderer.display(0, 0, displaySize, displaySize);
+                glFinish();
+                double displayMax = now() - t3;
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+                // Same samples in every format, so the difference is the format's error
+                std::vector<float> &output = accumulator == BUDDHABROT_ACCUMULATOR_RGBA32F ? reference : histogram;
+                output.resize((size_t)size * size * 3);
+                renderer.readHistogram(&output[0]);
+                double difference = 0;
+                if (accumulator == BUDDHABROT_ACCUMULATOR_RGBA32F)
+                {
+                    for (float v : reference)
+                        referenceSquares += (double)v * v;
+                }
+                else
+                {
+                    for (size_t i = 0; i < reference.size(); i++)
+                        difference += ((double)histogram[i] - reference[i]) * (histogram[i] - reference[i]);
+                }
+                std::cerr << size << "  " << (engine == BUDDHABROT_ENGINE_COMPUTE ? "compute " : "geometry") << "  "
+                          << accumulator_name(renderer.getAccumulator()) << "  " << renderer.getAccumulatorBytes() / 1048576.0
+                          << "  " << t1 - t0 << "  " << t2 - t1 << "  " << displayMax << "  " << t2 - t0 << "  "
+                          << sqrt(difference / referenceSquares)
+                          << std::endl;
+            }
+        }
+    }
+    glDeleteFramebuffers(1, &displayFramebuffer);
+    glDeleteTextures(1, &displayTexture);
+    delete fractal;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int size = 512;
+    int samplerSize = 512;
+    int referenceBudget = 2000000;
+    int maxPresets = 3;
+    std::vector<int> budgets = {25000, 50000, 100000, 200000};
+    std::vector<std::string> files;
+    std::string csvPath, baselinePath, writeBaselinePath;
+    double tolerance = 0.1;
+    // Absolute, on the relative bias and on the relative change of the reference totals
+    double biasTolerance = 0.01;
+    bool gpu = false;
+    bool symmetry = false;
+    bool adaptive = false;
+    bool engineBenchmark = false;
+    bool accumulatorBenchmark = false;
+    int seedsResolution = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--size" && hasValue)
+            size = atoi(argv[++i]);
+        else if (arg == "--sampler-size" && hasValue)
+            samplerSize = atoi(argv[++i]);
+        else if (arg == "--reference" && hasValue)
+            referenceBudget = atoi(argv[++i]);
+        else if (arg == "--presets" && hasValue)
+            maxPresets = atoi(argv[++i]);
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = atof(argv[++i]);
+        else if (arg == "--bias-tolerance" && hasValue)
+            biasTolerance = atof(argv[++i]);
+        else if (arg == "--csv" && hasValue)
+            csvPath = argv[++i];
+        else if (arg == "--baseline" && hasValue)
+            baselinePath = argv[++i];
+        else if (arg == "--write-baseline" && hasValue)
+            writeBaselinePath = argv[++i];
+        else if (arg == "--gpu")
+            gpu = true;
+        else if (arg == "--symmetry")
+            symmetry = true;
+        else if (arg == "--adaptive")
+            adaptive = true;
+        else if (arg == "--seeds" && hasValue)
+            seedsResolution = atoi(argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            cpuThreads = atoi(argv[++i]);
+        else if (arg == "--pin")
+            pinThreads = true;
+        else if (arg == "--engine-benchmark")
+        {
+            engineBenchmark = true;
+            gpu = true;
+        }
+        else if (arg == "--accumulator-benchmark")
+        {
+            accumulatorBenchmark = true;
+            gpu = true;
+        }
+        else if (arg == "--splat-benchmark")
+            return splat_benchmark(referenceBudget);
+        else if (arg == "--budgets" && hasValue)
+        {
+            budgets.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ','))
+                budgets.push_back(atoi(item.c_str()));
+        }
+        else if (arg.size() > 2 && arg.substr(0, 2) == "--")
+        {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return 2;
+        }
+        else
+            files.push_back(arg);
+    }
+    if (files.empty())
+    {
+        files.push_back("../data/animations.json");
+        files.push_back("animation-1.json");
+        files.push_back("animation-6.json");
+        files.push_back("animation-7.json");
+    }
+
+    std::vector<BuddhabrotFractal::BuddhabrotFractalParameters> presets;
+    for (const std::string &file : files)
+    {
+        std::vector<BuddhabrotFractal::BuddhabrotFractalParameters> loaded = load_presets(file);
+        for (size_t i = 0; i < loaded.size() && (maxPresets <= 0 || (int)i < maxPresets); i++)
+            presets.push_back(loaded[i]);
+    }
+    if (presets.empty())
+    {
+        std::cerr << "no presets found" << std::endl;
+        return 2;
+    }
+
+    std::vector<QualityConfig> configs;
+    std::vector<std::string> engines = {"cpu"};
+    GLFWwindow *window = nullptr;
+    if (gpu)
+    {
+        glfwInit();
+        glfwDefaultWindowHints();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+        window = glfwCreateWindow(64, 64, "Buddhabrot Quality", nullptr, nullptr);
+        bool compute = window != nullptr;
+        if (window == nullptr)
+        {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            window = glfwCreateWindow(64, 64, "Buddhabrot Quality", nullptr, nullptr);
+        }
+        glfwMakeContextCurrent(window);
+        glewInit();
+        if (engineBenchmark)
+            return engine_benchmark(referenceBudget, compute);
+        if (accumulatorBenchmark)
+            return accumulator_benchmark(referenceBudget, compute);
+        engines.push_back("gpu");
+        if (compute)
+            engines.push_back("gpu-compute");
+    }
+    for (const std::string &engine : engines)
+    {
+        for (int jitter : {SAMPLER_JITTER_GAUSSIAN, SAMPLER_JITTER_R2, SAMPLER_JITTER_SOBOL})
+            configs.push_back({engine, jitter});
+    }
+    if (seedsResolution > 0)
+        configs.push_back({"cpu", QUALITY_SEEDS});
+    const char *seedsPath = "quality_seeds.db";
+
+    BuddhabrotFractal *fractal = Fractal::CreateBuddhabrot();
+    BuddhabrotRendererOptions options = make_options(fractal, samplerSize, size, referenceBudget, SAMPLER_JITTER_SOBOL);
+
+    std::ofstream csv;
+    if (!csvPath.empty())
+        csv.open(csvPath.c_str());
+    std::ostream &out = csvPath.empty() ? std::cout : csv;
+    out << "preset,engine,jitter,budget,samples,seconds,rmse,psnr,bias" << std::endl;
+
+    // Every sampler converges to its own expectation, so each is scored against a
+    // reference rendered with the same jitter (GPU engines share the CPU one).
+    // Bias is measured separately, against the mean of the importance sampler
+    // references across jitters.
+    std::vector<int> referenceJitters = {SAMPLER_JITTER_GAUSSIAN, SAMPLER_JITTER_R2, SAMPLER_JITTER_SOBOL};
+    if (seedsResolution > 0)
+        referenceJitters.push_back(QUALITY_SEEDS);
+
+    // Per configuration: sum of log efficiency, of relative bias, and per run
+    // the log relative MSE and log samples (NAN where missing)
+    std::map<std::string, double> logEfficiency, biasSum;
+    std::map<std::string, std::vector<double>> logMSE, logSamples;
+    std::map<std::string, int> runs;
+    // Per reference jitter: sums of the relative total and RMS difference to the mean reference
+    std::map<int, double> referenceBias, referenceDifference;
+    int referenceRuns = 0;
+    // Per preset: total of the mean reference, 0 where it was empty
+    std::vector<double> referenceTotals(presets.size(), 0);
+    size_t runCount = presets.size() * budgets.size();
+
+    for (size_t p = 0; p < presets.size(); p++)
+    {
+        fractal->parameters = presets[p];
+
+        if (seedsResolution > 0)
+        {
+            std::vector<SeedRecord> records;
+            double seedArea;
+            FractalTransform t = fractal->getTransform();
+            int seedsSymmetry = symmetry ? t.getSymmetry() : FRACTAL_SYMMETRY_NONE;
+            SeedGrid grid = {seedsResolution, 4, options.samplerSize, options.samplerMipmapLevel, options.samplerMaxIterations};
+            SeedDatabase::generate(cpu_pool(), t, grid, seedsSymmetry != FRACTAL_SYMMETRY_NONE, 1 + (int)p, records, seedArea);
+            SeedDatabase::write(seedsPath, fractal->getOrbitKey(options.importanceCacheTolerance), seedsSymmetry, grid, seedArea, records);
+            delete seeds;
+            seeds = new SeedDatabase(seedsPath);
+        }
+
+        std::map<int, std::vector<float>> references;
+        std::vector<float> mean, image;
+        int samplesCount;
+        options.samplerLowerBound = referenceBudget;
+        options.exploitSymmetry = symmetry;
+        options.samplerAdaptiveLevels = adaptive ? 3 : 0;
+        options.samplerAdaptiveStrength = 0.75f;
+        for (int jitter : referenceJitters)
+        {
+            options.samplerJitter = jitter;
+            render_histogram({"cpu", jitter}, options, 1000 + (int)p, references[jitter], samplesCount);
+            if (jitter == QUALITY_SEEDS)
+                continue;
+            // Mean of the gaussian, r2 and sobol references
+            mean.resize(references[jitter].size());
+            for (size_t i = 0; i < mean.size(); i++)
+                mean[i] += references[jitter][i] / 3;
+        }
+        double meanTotal = 0, meanSquares = 0;
+        for (float v : mean)
+        {
+            meanTotal += v;
+            meanSquares += (double)v * v;
+        }
+        if (meanSquares == 0)
+            continue;
+        referenceTotals[p] = meanTotal;
+        for (int jitter : referenceJitters)
+        {
+            double total = 0, squares = 0;
+            for (size_t i = 0; i < mean.size(); i++)
+            {
+                double d = (double)references[jitter][i] - mean[i];
+                total += references[jitter][i];
+                squares += d * d;
+            }
+            referenceBias[jitter] += total / meanTotal - 1;
+            referenceDifference[jitter] += sqrt(squares / meanSquares);
+        }
+        referenceRuns++;
+
+        for (const QualityConfig &config : configs)
+        {
+            std::string key = config.engine + " " + jitter_name(config.jitter);
+            const std::vector<float> &reference = references[config.jitter];
+            double referenceSquares = 0, referencePeak = 0;
+            for (float v : reference)
+            {
+                referenceSquares += (double)v * v;
+                referencePeak = v > referencePeak ? v : referencePeak;
+            }
+            double referenceMeanSquare = referenceSquares / reference.size();
+            logMSE[key].resize(runCount, NAN);
+            logSamples[key].resize(runCount, NAN);
+            for (size_t b = 0; b < budgets.size(); b++)
+            {
+                options.samplerLowerBound = budgets[b];
+                options.samplerJitter = config.jitter;
+                double seconds = render_histogram(config, options, (int)p, image, samplesCount);
+                double squares = 0, total = 0;
+                for (size_t i = 0; i < image.size(); i++)
+                {
+                    double d = (double)image[i] - reference[i];
+                    squares += d * d;
+                    total += image[i];
+                }
+                double mse = squares / image.size();
+                double rmse = sqrt(mse);
+                double psnr = mse > 0 ? 10.0 * log10(referencePeak * referencePeak / mse) : INFINITY;
+                double bias = total / meanTotal - 1;
+                out << p << "," << config.engine << "," << jitter_name(config.jitter) << "," << budgets[b] << ","
+                    << samplesCount << "," << seconds << "," << rmse << "," << psnr << "," << bias << std::endl;
+
+                double relativeMSE = mse / referenceMeanSquare;
+                if (relativeMSE > 0 && seconds > 0)
+                {
+                    logEfficiency[key] += -log(relativeMSE * seconds);
+                    biasSum[key] += bias;
+                    logMSE[key][p * budgets.size() + b] = log(relativeMSE);
+                    logSamples[key][p * budgets.size() + b] = log((double)samplesCount);
+                    runs[key]++;
+                }
+            }
+        }
+    }
+
+    if (referenceRuns > 0)
+    {
+        std::cerr << "reference  total bias   rel. RMS difference to the mean reference" << std::endl;
+        for (int jitter : referenceJitters)
+        {
+            std::string name = jitter_name(jitter);
+            std::cerr << name << std::string(11 - name.size(), ' ') << referenceBias[jitter] / referenceRuns << "   "
+                      << referenceDifference[jitter] / referenceRuns << std::endl;
+        }
+        std::cerr << std::endl;
+    }
+
+    // Summary: geometric means across presets and budgets. The convergence
+    // exponent a (relative MSE ~ samples^-a) is fitted per configuration within
+    // each preset, 1 for plain Monte Carlo; the samples needed to reach the
+    // gaussian noise level follow from it rather than from assuming a = 1.
+    std::map<std::string, double> efficiency;
+    std::cerr << "configuration        efficiency   bias   exponent   samples for gaussian noise level" << std::endl;
+    for (const QualityConfig &config : configs)
+    {
+        std::string key = config.engine + " " + jitter_name(config.jitter);
+        if (runs[key] == 0)
+            continue;
+        efficiency[key] = exp(logEfficiency[key] / runs[key]);
+
+        double sxy = 0, sxx = 0;
+        for (size_t p = 0; p < presets.size(); p++)
+        {
+            double mx = 0, my = 0;
+            int n = 0;
+            for (size_t b = 0; b < budgets.size(); b++)
+            {
+                size_t r = p * budgets.size() + b;
+                if (isnan(logMSE[key][r]))
+                    continue;
+                mx += logSamples[key][r];
+                my += logMSE[key][r];
+                n++;
+            }
+            if (n < 2)
+                continue;
+            mx /= n;
+            my /= n;
+            for (size_t b = 0; b < budgets.size(); b++)
+            {
+                size_t r = p * budgets.size() + b;
+                if (isnan(logMSE[key][r]))
+                    continue;
+                sxy += (logSamples[key][r] - mx) * (logMSE[key][r] - my);
+                sxx += (logSamples[key][r] - mx) * (logSamples[key][r] - mx);
+            }
+        }
+        double exponent = sxx > 0 && sxy < 0 ? -sxy / sxx : 1;
+
+        // Samples this configuration needs for the gaussian MSE of the same run,
+        // relative to the samples gaussian used
+        std::string gaussian = config.engine + " gaussian";
+        double logRatio = 0;
+        int matched = 0;
+        for (size_t r = 0; r < runCount && runs[gaussian] > 0; r++)
+        {
+            if (isnan(logMSE[key][r]) || isnan(logMSE[gaussian][r]))
+                continue;
+            logRatio += logSamples[key][r] - logSamples[gaussian][r] + (logMSE[key][r] - logMSE[gaussian][r]) / exponent;
+            matched++;
+        }
+        double relativeBudget = matched > 0 ? exp(logRatio / matched) : 1;
+        std::cerr << key << std::string(key.size() < 21 ? 21 - key.size() : 1, ' ') << efficiency[key] << "   "
+                  << biasSum[key] / runs[key] << "   " << exponent << "   x" << relativeBudget << std::endl;
+    }
+
+    // Baseline lines: "<engine> <jitter> <efficiency> <bias>" per configuration and
+    // "reference <preset> <total>" per preset; both depend on the presets and sizes
+    std::map<std::string, double> bias;
+    for (auto &item : efficiency)
+        bias[item.first] = biasSum[item.first] / runs[item.first];
+    if (!writeBaselinePath.empty())
+    {
+        std::ofstream baseline(writeBaselinePath.c_str());
+        baseline.precision(9);
+        for (auto &item : efficiency)
+            baseline << item.first << " " << item.second << " " << bias[item.first] << std::endl;
+        for (size_t p = 0; p < presets.size(); p++)
+        {
+            if (referenceTotals[p] > 0)
+                baseline << "reference " << p << " " << referenceTotals[p] << std::endl;
+        }
+    }
+
+    int status = 0;
+    if (!baselinePath.empty())
+    {
+        std::ifstream baseline(baselinePath.c_str());
+        std::string line;
+        while (std::getline(baseline, line))
+        {
+            std::stringstream fields(line);
+            std::string first, second;
+            fields >> first >> second;
+            if (first == "reference")
+            {
+                size_t p = atoi(second.c_str());
+                double total;
+                if (!(fields >> total) || p >= presets.size() || referenceTotals[p] == 0)
+                    continue;
+                if (fabs(referenceTotals[p] / total - 1) > biasTolerance)
+                {
+                    std::cerr << "REGRESSION: preset " << p << " reference total " << referenceTotals[p]
+                              << " != baseline " << total << std::endl;
+                    status = 1;
+                }
+                continue;
+            }
+            std::string key = first + " " + second;
+            double value, baselineBias;
+            if (!(fields >> value) || efficiency.count(key) == 0)
+                continue;
+            if (efficiency[key] < value * (1 - tolerance))
+            {
+                std::cerr << "REGRESSION: " << key << " efficiency " << efficiency[key] << " < baseline " << value << std::endl;
+                status = 1;
+            }
+            if (fields >> baselineBias && fabs(bias[key] - baselineBias) > biasTolerance)
+            {
+                std::cerr << "REGRESSION: " << key << " bias " << bias[key] << " != baseline " << baselineBias << std::endl;
+                status = 1;
+            }
+        }
+    }
+
+    if (seeds != nullptr)
+    {
+        delete seeds;
+        remove(seedsPath);
+    }
+    delete fractal;
+    if (window)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return status;
+}
@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "render_server.h"
+
+struct RenderServer::Pending
+{
+    RenderRequestHeader request;
+    std::vector<float> colormap;
+    RenderResponseHeader response;
+    std::shared_ptr<std::vector<unsigned char>> payload;
+    double received;
+    bool done;
+};
+
+struct RenderServer::Renderer
+{
+    BuddhabrotRenderer *renderer;
+    // Key of the accumulation currently in the renderer's texture
+    std::string key;
+    std::vector<float> colormap;
+    long long lastUsed;
+    GLuint texture;
+    // GPU memory of the accumulation target and the output texture
+    size_t bytes;
+};
+
+inline double server_time()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool read_all(int fd, void *data, size_t length)
+{
+    char *p = (char *)data;
+    while (length > 0)
+    {
+        ssize_t n = read(fd, p, length);
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *data, size_t length)
+{
+    const char *p = (const char *)data;
+    while (length > 0)
+    {
+        ssize_t n = write(fd, p, length);
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+float get_le_float(const unsigned char *p)
+{
+    uint32_t bits = get_le32(p);
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+void put_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+void put_le_float(unsigned char *p, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    put_le32(p, bits);
+}
+
+void decode_request(const unsigned char *p, RenderRequestHeader &request)
+{
+    request.magic = get_le32(p);
+    request.id = get_le32(p + 4);
+    for (int i = 0; i < 13; i++)
+        request.parameters[i] = get_le_float(p + 8 + i * 4);
+    request.size = get_le32(p + 60);
+    request.budget = get_le32(p + 64);
+    request.format = get_le32(p + 68);
+    request.colormapLength = get_le32(p + 72);
+}
+
+void encode_response(const RenderResponseHeader &response, unsigned char *p)
+{
+    put_le32(p, response.magic);
+    put_le32(p + 4, response.id);
+    put_le32(p + 8, response.status);
+    put_le32(p + 12, response.format);
+    put_le32(p + 16, response.size);
+    put_le32(p + 20, response.batch);
+    put_le_float(p + 24, response.renderMilliseconds);
+    put_le32(p + 28, response.length);
+}
+
+void put_be32(std::vector<unsigned char> &out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+void png_chunk(std::vector<unsigned char> &out, const char *type, const unsigned char *data, size_t length)
+{
+    put_be32(out, length);
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + length);
+    uLong crc = crc32(0, (const Bytef *)type, 4);
+    if (length > 0)
+        crc = crc32(crc, data, length);
+    put_be32(out, crc);
+}
+
+// 8-bit RGB PNG from OpenGL rows (bottom to top), with the Sub filter on every row;
+// false if zlib fails
+bool encode_png(const unsigned char *rgb, int width, int height, std::vector<unsigned char> &out)
+{
+    int stride = width * 3;
+    std::vector<unsigned char> filtered((stride + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *row = rgb + (size_t)(height - 1 - y) * stride;
+        unsigned char *f = &filtered[(size_t)y * (stride + 1)];
+        f[0] = 1;
+        for (int i = 0; i < stride; i++)
+            f[i + 1] = row[i] - (i >= 3 ? row[i - 3] : 0);
+    }
+    uLongf compressedLength = compressBound(filtered.size());
+    std::vector<unsigned char> compressed(compressedLength);
+    if (compress2(&compressed[0], &compressedLength, &filtered[0], filtered.size(), Z_BEST_SPEED) != Z_OK)
+    {
+        out.clear();
+        return false;
+    }
+
+    static const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.assign(signature, signature + 8);
+    std::vector<unsigned char> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(2); // truecolor
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    png_chunk(out, "IHDR", &header[0], header.size());
+    png_chunk(out, "IDAT", &compressed[0], compressedLength);
+    png_chunk(out, "IEND", nullptr, 0);
+    return true;
+}
+
+// Requests with the same key can share one accumulation
+std::string render_key(const RenderRequestHeader &request, int budget)
+{
+    std::string key((const char *)request.parameters, sizeof(request.parameters));
+    return key + std::to_string(request.size) + ":" + std::to_string(budget);
+}
+
+RenderServer::RenderServer(const std::string &_path, const BuddhabrotRendererOptions &_options)
+    : path(_path), options(_options), cache(_options.importanceCacheBytes)
+{
+    fractal = Fractal::CreateBuddhabrot();
+    options.fractal = fractal;
+    residentBytes = 0;
+    renderCounter = 0;
+    requests = 0;
+    renders = 0;
+    reused = 0;
+    glGenFramebuffers(1, &framebuffer);
+
+    // A client closing early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "render server: cannot create socket " << path << std::endl;
+        if (listener >= 0)
+            close(listener);
+        listener = -1;
+        return;
+    }
+    strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        std::cerr << "render server: cannot listen on " << path << std::endl;
+        close(listener);
+        listener = -1;
+        return;
+    }
+    std::thread([this] { acceptLoop(); }).detach();
+}
+
+void RenderServer::acceptLoop()
+{
+    while (true)
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+            return;
+        std::thread([this, connection] { serveConnection(connection); }).detach();
+    }
+}
+
+void RenderServer::serveConnection(int connection)
+{
+    while (true)
+    {
+        Pending pending;
+        RenderRequestHeader &request = pending.request;
+        unsigned char header[RENDER_REQUEST_BYTES];
+        if (!read_all(connection, header, sizeof(header)))
+            break;
+        decode_request(header, request);
+        pending.received = server_time();
+        pending.done = false;
+        RenderResponseHeader &response = pending.response;
+        response.magic = RENDER_RESPONSE_MAGIC;
+        response.id = request.id;
+        response.status = RENDER_STATUS_OK;
+        response.format = request.format;
+        response.size = request.size;
+        response.batch = 0;
+        response.renderMilliseconds = 0;
+        response.length = 0;
+
+        bool valid = request.magic == RENDER_REQUEST_MAGIC && request.size >= 16 && request.size <= MaxSize &&
+                     request.format <= RENDER_FORMAT_HISTOGRAM && request.colormapLength <= MaxColormapLength &&
+                     request.budget <= MaxBudget;
+        if (valid && request.colormapLength > 0)
+        {
+            std::vector<unsigned char> colormap(request.colormapLength * 9 * 4);
+            if (!read_all(connection, &colormap[0], colormap.size()))
+                break;
+            pending.colormap.resize(request.colormapLength * 9);
+            for (size_t i = 0; i < pending.colormap.size(); i++)
+                pending.colormap[i] = get_le_float(&colormap[i * 4]);
+        }
+        unsigned char encoded[RENDER_RESPONSE_BYTES];
+        if (!valid)
+        {
+            // The rest of the stream cannot be trusted, answer and hang up
+            response.status = RENDER_STATUS_BAD_REQUEST;
+            encode_response(response, encoded);
+            write_all(connection, encoded, sizeof(encoded));
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(&pending);
+        }
+        condition.notify_all();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&] { return pending.done; });
+        }
+        response.length = pending.payload->size();
+        encode_response(response, encoded);
+        if (!write_all(connection, encoded, sizeof(encoded)) ||
+            !write_all(connection, pending.payload->data(), pending.payload->size()))
+            break;
+    }
+    close(connection);
+}
+
+void RenderServer::run()
+{
+    while (isOpen())
+    {
+        std::vector<Pending *> pending;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return !queue.empty(); });
+            pending.assign(queue.begin(), queue.end());
+            queue.clear();
+        }
+        // Everything queued while the last batch rendered is grouped by key,
+        // in order of the oldest request of each group
+        while (!pending.empty())
+        {
+            int budget = pending[0]->request.budget > 0 ? pending[0]->request.budget : options.samplerLowerBound;
+            std::string key = render_key(pending[0]->request, budget);
+            std::vector<Pending *> batch, rest;
+            for (Pending *p : pending)
+            {
+                int b = p->request.budget > 0 ? p->request.budget : options.samplerLowerBound;
+                (render_key(p->request, b) == key ? batch : rest).push_back(p);
+            }
+            renderBatch(batch);
+            pending.swap(rest);
+        }
+    }
+}
+
+RenderServer::Renderer *RenderServer::getRenderer(int size)
+{
+    std::map<int, Renderer *>::iterator it = renderers.find(size);
+    if (it != renderers.end())
+    {
+        it->second->lastUsed = renderCounter++;
+        return it->second;
+    }
+    // Upper bound of the new renderer's memory before its format fallbacks are
+    // known: the accumulation target, the compute engine's counters and the output
+    size_t pixels = (size_t)size * size;
+    size_t bytes = pixels * 4;
+    bytes += pixels * (options.accumulator == BUDDHABROT_ACCUMULATOR_RGBA32F ? 16 : 12);
+    if (options.engine == BUDDHABROT_ENGINE_COMPUTE)
+        bytes += pixels * 3 * sizeof(GLuint);
+    while (!renderers.empty() && ((int)renderers.size() >= MaxRenderers || residentBytes + bytes > MaxResidentBytes))
+    {
+        std::map<int, Renderer *>::iterator oldest = renderers.begin();
+        for (it = renderers.begin(); it != renderers.end(); it++)
+        {
+            if (it->second->lastUsed < oldest->second->lastUsed)
+                oldest = it;
+        }
+        deleteRenderer(oldest);
+    }
+    BuddhabrotRendererOptions rendererOptions = options;
+    rendererOptions.renderSize = size;
+    Renderer *entry = new Renderer();
+    entry->renderer = new BuddhabrotRenderer(rendererOptions, &cache);
+    entry->bytes = entry->renderer->getAccumulatorBytes() + pixels * 4;
+    residentBytes += entry->bytes;
+    entry->lastUsed = renderCounter++;
+    glGenTextures(1, &entry->texture);
+    glBindTexture(GL_TEXTURE_2D, entry->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    renderers[size] = entry;
+    return entry;
+}
+
+void RenderServer::deleteRenderer(std::map<int, Renderer *>::iterator it)
+{
+    residentBytes -= it->second->bytes;
+    delete it->second->renderer;
+    glDeleteTextures(1, &it->second->texture);
+    delete it->second;
+    renderers.erase(it);
+}
+
+void RenderServer::renderBatch(std::vector<Pending *> &batch)
+{
+    double t0 = server_time();
+    const RenderRequestHeader &request = batch[0]->request;
+    int size = request.size;
+    int budget = request.budget > 0 ? request.budget : options.samplerLowerBound;
+    std::string key = render_key(request, budget);
+    Renderer *entry = getRenderer(size);
+    if (entry->key != key)
+    {
+        int i = 0;
+        fractal->parameters.z3_scaler = request.parameters[i++];
+        fractal->parameters.z3_angle = request.parameters[i++];
+        fractal->parameters.z3_yscale = request.parameters[i++];
+        fractal->parameters.z2_scaler = request.parameters[i++];
+        fractal->parameters.z2_angle = request.parameters[i++];
+        fractal->parameters.z2_yscale = request.parameters[i++];
+        fractal->parameters.z1_scaler = request.parameters[i++];
+        fractal->parameters.z1_angle = request.parameters[i++];
+        fractal->parameters.z1_yscale = request.parameters[i++];
+        fractal->parameters.rotation_zxcx = request.parameters[i++];
+        fractal->parameters.rotation_zxcy = request.parameters[i++];
+        fractal->parameters.rotation_zycx = request.parameters[i++];
+        fractal->parameters.rotation_zycy = request.parameters[i++];
+        entry->renderer->setLowerBound(budget);
+        entry->renderer->accumulate();
+        entry->key = key;
+        renders++;
+    }
+    else
+    {
+        reused++;
+    }
+
+    // Requests asking for the same output share one payload
+    std::vector<Pending *> encoded;
+    std::vector<unsigned char> pixels;
+    for (Pending *p : batch)
+    {
+        for (Pending *q : encoded)
+        {
+            if (q->request.format == p->request.format && q->colormap == p->colormap)
+            {
+                p->payload = q->payload;
+                p->response.status = q->response.status;
+                break;
+            }
+        }
+        if (p->payload)
+            continue;
+        p->payload = std::make_shared<std::vector<unsigned char>>();
+        if (p->request.format == RENDER_FORMAT_HISTOGRAM)
+        {
+            std::vector<float> histogram(size * size * 3);
+            entry->renderer->readHistogram(&histogram[0]);
+            p->payload->resize(sizeof(float) * histogram.size());
+            for (size_t i = 0; i < histogram.size(); i++)
+                put_le_float(&(*p->payload)[i * 4], histogram[i]);
+        }
+        else
+        {
+            if (p->colormap != entry->colormap)
+            {
+                if (p->colormap.empty())
+                    entry->renderer->setDefaultColormap();
+                else
+                {
+                    int length = p->request.colormapLength;
+                    float *colormap = &p->colormap[0];
+                    entry->renderer->setColormap(colormap, colormap + length * 3, colormap + length * 6, length);
+                }
+                entry->colormap = p->colormap;
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, entry->texture, 0);
+            entry->renderer->display(0, 0, size, size);
+            pixels.resize(size * size * 3);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, size, size, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            if (!encode_png(&pixels[0], size, size, *p->payload))
+                p->response.status = RENDER_STATUS_ERROR;
+        }
+        encoded.push_back(p);
+    }
+
+    double t1 = server_time();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Pending *p : batch)
+        {
+            p->response.batch = batch.size();
+            p->response.renderMilliseconds = (t1 - t0) * 1000;
+            p->done = true;
+            latencies.push_back(t1 - p->received);
+        }
+    }
+    condition.notify_all();
+
+    long long before = requests;
+    requests += batch.size();
+    if (before / 100 != requests / 100)
+        printStats();
+}
+
+void RenderServer::printStats()
+{
+    std::vector<double> sorted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sorted.swap(latencies);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    std::cerr << "render server: " << requests << " requests, " << renders << " renders, " << reused << " reused";
+    if (!sorted.empty())
+    {
+        std::cerr << ", latency p50 " << sorted[sorted.size() / 2] * 1000 << " ms, p99 "
+                  << sorted[sorted.size() * 99 / 100] * 1000 << " ms";
+    }
+    std::cerr << std::endl;
+}
+
+RenderServer::~RenderServer()
+{
+    if (listener >= 0)
+    {
+        shutdown(listener, SHUT_RDWR);
+        close(listener);
+        unlink(path.c_str());
+    }
+    while (!renderers.empty())
+        deleteRenderer(renderers.begin());
+    glDeleteFramebuffers(1, &framebuffer);
+    delete fractal;
+}
@@ -0,0 +1,135 @@
+#ifndef BUDDHABROT_RENDERER_RENDER_SERVER_H
+#define BUDDHABROT_RENDERER_RENDER_SERVER_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+
+// Off-screen render server on a local (Unix domain) stream socket. It renders
+// into framebuffers of a hidden GLFW window, so it still needs a display to
+// create the GL context (e.g. Xvfb on a machine without one).
+//
+// A client sends any number of requests on a connection and gets one response
+// per request, in order. All integers and floats are 32-bit little-endian,
+// packed in field order without padding, whatever the server's byte order.
+//
+//   request:  RenderRequestHeader (RENDER_REQUEST_BYTES), then if colormapLength > 0
+//             three colormaps of colormapLength RGB float triples each (the bands
+//             of setColormap)
+//   response: RenderResponseHeader (RENDER_RESPONSE_BYTES), then length payload bytes
+//
+// Requests are queued from the connection threads and rendered on the thread
+// that owns the GL context. Requests with identical parameters, size and budget
+// that are queued together share one accumulation, and a repeat of the last
+// render of a size reuses its accumulation without sampling again. Renderers,
+// with their accumulation textures, are kept per size within a memory cap; they
+// share one importance cache.
+
+#define RENDER_REQUEST_MAGIC 0x51524242  // "BBRQ"
+#define RENDER_RESPONSE_MAGIC 0x53524242 // "BBRS"
+
+#define RENDER_REQUEST_BYTES 76
+#define RENDER_RESPONSE_BYTES 32
+
+// PNG, 8-bit RGB, size x size
+#define RENDER_FORMAT_PNG 0
+// size x size x 3 float band counts, rows bottom to top
+#define RENDER_FORMAT_HISTOGRAM 1
+
+#define RENDER_STATUS_OK 0
+#define RENDER_STATUS_BAD_REQUEST 1
+// The request was valid but its output could not be produced
+#define RENDER_STATUS_ERROR 2
+
+struct RenderRequestHeader
+{
+    uint32_t magic;
+    uint32_t id; // echoed in the response
+    // Same order as the buddhabrot_parameters OSC message
+    float parameters[13];
+    uint32_t size;
+    // Sampler lower bound, 0 uses the server default; above
+    // RenderServer::MaxBudget the request is rejected as BAD_REQUEST
+    uint32_t budget;
+    uint32_t format;
+    // Entries per colormap, 0 keeps the default colormap
+    uint32_t colormapLength;
+};
+
+struct RenderResponseHeader
+{
+    uint32_t magic;
+    uint32_t id;
+    uint32_t status;
+    uint32_t format;
+    uint32_t size;
+    // Number of requests served by the same accumulation
+    uint32_t batch;
+    float renderMilliseconds;
+    uint32_t length;
+};
+
+class RenderServer
+{
+  public:
+    // options are the defaults for every renderer; renderSize and samplerLowerBound
+    // are taken from each request
+    RenderServer(const std::string &path, const BuddhabrotRendererOptions &options);
+
+    bool isOpen() { return listener >= 0; }
+
+    // Serve requests on the calling thread, which must own the GL context
+    void run();
+
+    ~RenderServer();
+
+    static const int MaxSize = 4096;
+    static const int MaxColormapLength = 4096;
+    // Samples per request; one render blocks every other client, so this also
+    // bounds how long a request can hold the render thread
+    static const uint32_t MaxBudget = 4 << 20;
+    // Renderers kept for distinct sizes, least recently used ones are deleted
+    // beyond this count or when their textures would exceed MaxResidentBytes
+    static const int MaxRenderers = 4;
+    static const size_t MaxResidentBytes = 512 << 20;
+
+  private:
+    struct Pending;
+    struct Renderer;
+
+    void acceptLoop();
+    void serveConnection(int connection);
+    void renderBatch(std::vector<Pending *> &batch);
+    Renderer *getRenderer(int size);
+    void deleteRenderer(std::map<int, Renderer *>::iterator it);
+    void printStats();
+
+    std::string path;
+    BuddhabrotRendererOptions options;
+    int listener;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Pending *> queue;
+
+    BuddhabrotFractal *fractal;
+    ImportanceCache cache;
+    std::map<int, Renderer *> renderers;
+    size_t residentBytes;
+    long long renderCounter;
+    GLuint framebuffer;
+
+    long long requests;
+    long long renders;
+    long long reused;
+    std::vector<double> latencies;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <string>
 #include <iostream>
 #include <exception>
+#include <algorithm>
+#include <vector>
 
 #include "renderer.h"
 
@@ -81,8 +83,50 @@ GLuint compile_shader_program(std::string vs_code, std::string gs_code, std::str
     return program;
 }
 
-BuddhabrotSampler::BuddhabrotSampler(const BuddhabrotRendererOptions &_options) : options(_options)
+GLuint compile_compute_program(std::string cs_code)
 {
+    GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
+    shader_source_and_compile(cs, cs_code);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, cs);
+    glLinkProgram(program);
+    GLint v[1];
+    glGetProgramiv(program, GL_LINK_STATUS, v);
+    if (v[0] != GL_TRUE)
+    {
+        std::cerr << "program link error!" << std::endl;
+        throw ShaderCompileError();
+    }
+    return program;
+}
+
+void mirror_histogram(float *data, int size, int symmetry)
+{
+    if (symmetry == FRACTAL_SYMMETRY_NONE)
+        return;
+    for (int iy = 0; iy < size; iy++)
+    {
+        for (int ix = 0; ix < size; ix++)
+        {
+            int mx = symmetry == FRACTAL_SYMMETRY_MIRROR_X ? size - 1 - ix : ix;
+            int my = symmetry == FRACTAL_SYMMETRY_MIRROR_Y ? size - 1 - iy : iy;
+            int a = iy * size + ix, b = my * size + mx;
+            if (b < a)
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                float v = data[a * 3 + k] + (a == b ? data[a * 3 + k] : data[b * 3 + k]);
+                data[a * 3 + k] = v;
+                data[b * 3 + k] = v;
+            }
+        }
+    }
+}
+
+BuddhabrotSampler::BuddhabrotSampler(const BuddhabrotRendererOptions &_options, ImportanceCache *sharedCache)
+    : options(_options), ownCache(sharedCache != nullptr ? 0 : _options.importanceCacheBytes)
+{
+    cache = sharedCache != nullptr ? sharedCache : &ownCache;
     int size = options.samplerSize;
 
     glGenTextures(1, &framebufferTexture);
@@ -91,7 +135,8 @@ BuddhabrotSampler::BuddhabrotSampler(const BuddhabrotRendererOptions &_options)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    // R: escape iteration, G: visible orbit points for the adaptive sampler
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, size, size, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     // Create framebuffer and assign the texture
@@ -121,6 +166,7 @@ BuddhabrotSampler::BuddhabrotSampler(const BuddhabrotRendererOptions &_options)
                 vec2 z = vec2(0.0);
                 vec2 z1;
                 bool escaped = false;
+                int visible = 0;
                 int i;
                 for (i = 0; i <= u_maxIterations; i++) {
                     z1 = fractal(z, c);
@@ -133,9 +179,15 @@ BuddhabrotSampler::BuddhabrotSampler(const BuddhabrotRendererOptions &_options)
                         escaped = true;
                         break;
                     }
+                    // Points the accumulation pass would draw inside the render target
+                    vec2 p = fractal_projection(z, c) / 2.0;
+                    if (i >= 1 && abs(p.x) <= 1.0 && abs(p.y) <= 1.0) {
+                        visible++;
+                    }
                 }
                 float v = float(i >= 16 ? i : 0) / 255.0;
-                frag_color = escaped ? vec4(vec3(v), 1.0) : vec4(0, 0, 0, 1);
+                float w = i < 256 ? float(visible) / 255.0 : 0.0;
+                frag_color = escaped ? vec4(v, w, 0.0, 1.0) : vec4(0, 0, 0, 1);
             }
         )__CODE__"));
 
@@ -163,42 +215,152 @@ BuddhabrotSampler::BuddhabrotSampler(const BuddhabrotRendererOptions &_options)
     sampler = sampler_create();
     sampler_set_size(sampler, mipmapSize, mipmapSize);
     sampler_set_lower_bound(sampler, options.samplerLowerBound);
+    sampler_set_jitter(sampler, options.samplerJitter);
+    sampler_set_adaptive(sampler, options.samplerAdaptiveLevels, options.samplerAdaptiveStrength);
 
-    glGenBuffers(1, &samplesBuffer);
+    glGenBuffers(SamplesBufferCount, samplesBuffers);
+    for (int i = 0; i < SamplesBufferCount; i++)
+        samplesBufferCapacity[i] = 0;
+    currentBuffer = 0;
+    samplesCount = 0;
+    symmetry = FRACTAL_SYMMETRY_NONE;
+
+    seeds = nullptr;
+    usingSeeds = false;
+    if (options.samplerSeedDatabase != nullptr)
+    {
+        seeds = new SeedDatabase(options.samplerSeedDatabase);
+        bool compatible = seeds->isOpen() && seeds->isCompatible(options.samplerSize, options.samplerMipmapLevel, options.samplerMaxIterations);
+        if (seeds->isOpen() && !compatible)
+            std::cerr << "seed database: generated for other importance sampler settings, not used" << std::endl;
+        if (!compatible)
+        {
+            delete seeds;
+            seeds = nullptr;
+        }
+    }
 
     assertGLError();
 }
 
 void BuddhabrotSampler::render()
 {
+    // A half-plane database can only stand in while the projection keeps its symmetry
+    if (seeds != nullptr && seeds->getKey() == options.fractal->getOrbitKey(options.importanceCacheTolerance) &&
+        (seeds->getSymmetry() == FRACTAL_SYMMETRY_NONE || seeds->getSymmetry() == options.fractal->getTransform().getSymmetry()))
+    {
+        usingSeeds = true;
+        symmetry = seeds->getSymmetry();
+        return;
+    }
+    usingSeeds = false;
+
+    symmetry = options.exploitSymmetry ? options.fractal->getTransform().getSymmetry() : FRACTAL_SYMMETRY_NONE;
+    sampler_set_half_plane(sampler, symmetry != FRACTAL_SYMMETRY_NONE);
+
+    // The escape map only depends on the orbits and the half-plane scissor.
+    // The adaptive visible counts also depend on the projection, which changes
+    // every frame of an animation, so the cache is bypassed when they are used.
+    // They come from the probe orbit of each importance pixel rather than the
+    // orbits drawn, which the accumulation pass cannot report back on OpenGL 3.3;
+    // for fixed parameters the history then only smooths, it does not learn.
+    bool adaptive = options.samplerAdaptiveLevels > 0;
+    bool cached = options.importanceCacheBytes > 0 && !adaptive;
+    int bufferSize = mipmapSize * mipmapSize;
+    std::string key;
+    if (cached)
+    {
+        key = options.fractal->getOrbitKey(options.importanceCacheTolerance) + std::to_string(symmetry);
+        const std::vector<unsigned char> *entry = cache->find(key);
+        if (entry != nullptr)
+        {
+            std::copy(entry->begin(), entry->end(), sampler_get_buffer(sampler));
+            return;
+        }
+    }
+
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
     glViewport(0, 0, options.samplerSize, options.samplerSize);
+    if (symmetry != FRACTAL_SYMMETRY_NONE)
+    {
+        // The sampler only reads the c.y >= 0 half
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, options.samplerSize / 2, options.samplerSize, options.samplerSize / 2);
+    }
     glUseProgram(program);
     options.fractal->setShaderUniforms(program);
     glBindVertexArray(vertexArray);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     glBindVertexArray(0);
     glUseProgram(0);
+    glDisable(GL_SCISSOR_TEST);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glBindTexture(GL_TEXTURE_2D, framebufferTexture);
     glGenerateMipmap(GL_TEXTURE_2D);
     glGetTexImage(GL_TEXTURE_2D, options.samplerMipmapLevel, GL_RED, GL_UNSIGNED_BYTE, sampler_get_buffer(sampler));
+    if (adaptive)
+        glGetTexImage(GL_TEXTURE_2D, options.samplerMipmapLevel, GL_GREEN, GL_UNSIGNED_BYTE, sampler_get_contribution_buffer(sampler));
     glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (cached)
+    {
+        std::vector<unsigned char> entry(sampler_get_buffer(sampler), sampler_get_buffer(sampler) + bufferSize);
+        cache->insert(key, entry);
+    }
 }
 
-void BuddhabrotSampler::sample()
+void BuddhabrotSampler::beginSamples()
 {
-    sampler_sample(sampler);
+    if (usingSeeds)
+    {
+        // Same budget rule as the importance sampler, halved for half-plane seeds
+        int budget = symmetry != FRACTAL_SYMMETRY_NONE ? options.samplerLowerBound / 2 : options.samplerLowerBound;
+        double cell = 4.0 / mipmapSize;
+        samplesCount = seeds->prepare(budget, cell * cell);
+        return;
+    }
+    samplesCount = sampler_prepare(sampler);
+}
 
-    float *samples = sampler_get_samples(sampler);
-    samplesCount = sampler_get_samples_count(sampler);
+int BuddhabrotSampler::nextSamples()
+{
+    // Without chunking the whole frame goes into one buffer; with chunking we cycle
+    // through a ring so the GPU can still be drawing the previous chunks.
+    int capacity = options.samplerChunkSize > 0 ? options.samplerChunkSize : samplesCount;
+    if (options.samplerChunkSize > 0)
+        currentBuffer = (currentBuffer + 1) % SamplesBufferCount;
+    if (capacity <= 0)
+        return 0;
 
-    glBindBuffer(GL_ARRAY_BUFFER, samplesBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * samplesCount, samples, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, samplesBuffers[currentBuffer]);
+    if (samplesBufferCapacity[currentBuffer] < capacity)
+    {
+        samplesBufferCapacity[currentBuffer] = options.samplerChunkSize > 0 ? capacity : capacity * 2;
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * samplesBufferCapacity[currentBuffer], nullptr, GL_STREAM_DRAW);
+    }
+    // Write the samples straight into the mapped buffer, no intermediate copy
+    float *samples = (float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(float) * 3 * capacity, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    int written = 0;
+    while (written < capacity)
+    {
+        int n = usingSeeds ? seeds->sampleInto(samples + written * 3, capacity - written)
+                           : sampler_sample_into(sampler, samples + written * 3, capacity - written);
+        if (n == 0)
+            break;
+        written += n;
+    }
+    glUnmapBuffer(GL_ARRAY_BUFFER);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     assertGLError();
+    return written;
+}
+
+void BuddhabrotSampler::setLowerBound(int lowerBound)
+{
+    options.samplerLowerBound = lowerBound;
+    sampler_set_lower_bound(sampler, lowerBound);
 }
 
 BuddhabrotSampler::~BuddhabrotSampler()
@@ -207,50 +369,169 @@ BuddhabrotSampler::~BuddhabrotSampler()
     glDeleteBuffers(1, &quadVertices);
     glDeleteFramebuffers(1, &framebuffer);
     glDeleteTextures(1, &framebufferTexture);
+    glDeleteBuffers(SamplesBufferCount, samplesBuffers);
     sampler_destroy(sampler);
+    delete seeds;
 }
 
-BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options) : options(_options), sampler(_options)
+BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options, ImportanceCache *sharedCache)
+    : options(_options), sampler(_options, sharedCache)
 {
-    glGenTextures(1, &framebufferTexture);
-    glBindTexture(GL_TEXTURE_2D, framebufferTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, options.renderSize, options.renderSize, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    engine = options.engine;
+    if (engine == BUDDHABROT_ENGINE_COMPUTE && major * 10 + minor < 43)
+    {
+        std::cerr << "compute engine needs OpenGL 4.3, using the geometry shader engine" << std::endl;
+        engine = BUDDHABROT_ENGINE_GEOMETRY;
+    }
+    accumulator = options.accumulator;
+    if (accumulator == BUDDHABROT_ACCUMULATOR_R32UI && major * 10 + minor < 42)
+    {
+        std::cerr << "R32UI accumulator needs OpenGL 4.2, using RGBA32F" << std::endl;
+        accumulator = BUDDHABROT_ACCUMULATOR_RGBA32F;
+    }
 
-    // Create framebuffer and assign the texture
+    // No mip chain: display() box-filters every format itself
+    size_t pixels = (size_t)options.renderSize * options.renderSize;
+    glGenTextures(1, &framebufferTexture);
     glGenFramebuffers(1, &framebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebufferTexture, 0);
+    if (accumulator == BUDDHABROT_ACCUMULATOR_R32UI)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, framebufferTexture);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32UI, options.renderSize, options.renderSize, 3, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        // Layered attachment: clears reach all three bands, and it sizes the
+        // render area of the geometry pass, which only writes through image atomics
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, framebufferTexture, 0);
+        accumulatorBytes = pixels * 3 * sizeof(GLuint);
+    }
+    else
+    {
+        bool half = accumulator == BUDDHABROT_ACCUMULATOR_RGB16F;
+        glBindTexture(GL_TEXTURE_2D, framebufferTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, half ? GL_RGB16F : GL_RGBA32F, options.renderSize, options.renderSize, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebufferTexture, 0);
+        accumulatorBytes = half ? pixels * 6 : pixels * 16;
+        if (half)
+        {
+            std::cerr << "RGB16F accumulator: pixel counts stop growing once they reach about 2048 times a single "
+                         "orbit point's weight, use it for previews"
+                      << std::endl;
+        }
+        if (half && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            // RGB16F is not required to be color-renderable, RGBA16F is
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, options.renderSize, options.renderSize, 0, GL_RGBA, GL_FLOAT, nullptr);
+            accumulatorBytes = pixels * 8;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glGenVertexArrays(1, &vertexArray);
     glBindVertexArray(vertexArray);
-    glBindBuffer(GL_ARRAY_BUFFER, sampler.getBuffer());
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    program = compile_shader_program(
-        R"__CODE__(#version 330
+    if (accumulator == BUDDHABROT_ACCUMULATOR_R32UI)
+    {
+        // Same orbits as below; each point carries its band and its weight,
+        // stochastically rounded to fixed point like the compute engine, and
+        // the fragment adds it to the band's counter
+        program = compile_shader_program(
+            R"__CODE__(#version 420
             layout(location = 0) in vec3 vi_sample;
             out vec3 vo_sample;
             void main () {
                 vo_sample = vi_sample;
             }
         )__CODE__",
-        std::string(R"__CODE__(#version 330
+            std::string(R"__CODE__(#version 420
+            layout(points) in;
+            layout(points, max_vertices = 256) out;
+            in vec3 vo_sample[1];
+            uniform float counterScale;
+            uniform uint seed;
+            flat out uint a_amount;
+            flat out int a_band;
+
+        )__CODE__") +
+                options.fractal->getShaderFunction() + std::string(R"__CODE__(
+
+            uint hash(uint x) {
+                x ^= x >> 16;
+                x *= 0x7feb352du;
+                x ^= x >> 15;
+                x *= 0x846ca68bu;
+                x ^= x >> 16;
+                return x;
+            }
+
+            void main () {
+                vec2 c = vo_sample[0].xy;
+                float weight = vo_sample[0].z * counterScale;
+                vec2 z = vec2(0);
+                int diverge = 0;
+                for(int i = 0; i < 256; i++) {
+                    z = fractal(z, c);
+                    if(z.x * z.x + z.y * z.y >= 16.0) {
+                        diverge = i;
+                        break;
+                    }
+                }
+                int band = diverge < 80 ? 0 : (diverge < 160 ? 1 : 2);
+                uint random = hash(uint(gl_PrimitiveIDIn) ^ seed);
+                z = vec2(0);
+                for(int i = 0; i < diverge; i++) {
+                    z = fractal(z, c);
+                    if(i >= 1) {
+                        random = random * 1664525u + 1013904223u;
+                        a_amount = uint(weight + float(random >> 8) * (1.0 / 16777216.0));
+                        a_band = band;
+                        gl_Position = vec4(fractal_projection(z, c) / 2.0, 0, 1);
+                        EmitVertex();
+                    }
+                }
+            }
+        )__CODE__"),
+            R"__CODE__(#version 420
+            layout(r32ui, binding = 0) uniform uimage2DArray histogram;
+            flat in uint a_amount;
+            flat in int a_band;
+            void main() {
+                if(a_amount != 0u) {
+                    imageAtomicAdd(histogram, ivec3(ivec2(gl_FragCoord.xy), a_band), a_amount);
+                }
+            }
+        )__CODE__");
+    }
+    else
+    {
+        program = compile_shader_program(
+            R"__CODE__(#version 330
+            layout(location = 0) in vec3 vi_sample;
+            out vec3 vo_sample;
+            void main () {
+                vo_sample = vi_sample;
+            }
+        )__CODE__",
+            std::string(R"__CODE__(#version 330
             layout(points) in;
             layout(points, max_vertices = 256) out;
             in vec3 vo_sample[1];
             out vec3 a_multiplier;
 
         )__CODE__") +
-            options.fractal->getShaderFunction() + std::string(R"__CODE__(
+                options.fractal->getShaderFunction() + std::string(R"__CODE__(
 
             void main () {
                 vec2 c = vo_sample[0].xy;
@@ -290,29 +571,86 @@ BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options
                 // }
             }
         )__CODE__"),
-        R"__CODE__(#version 330
+            R"__CODE__(#version 330
             in vec3 a_multiplier;
             layout(location = 0) out vec4 v_color;
             void main() {
                 v_color = vec4(a_multiplier, 1);
             }
         )__CODE__");
+    }
 
-    programDisplay = compile_shader_program(
-        R"__CODE__(#version 330
+    // average(position) of the display pass, the exact mean of the footprint x
+    // footprint texels around position
+    std::string histogramFunction;
+    if (accumulator == BUDDHABROT_ACCUMULATOR_R32UI)
+        histogramFunction = R"__CODE__(
+            uniform usampler2DArray texInput;
+            vec3 average(vec2 position) {
+                ivec2 base = clamp(ivec2(position * float(renderSize)) - footprint / 2, ivec2(0), ivec2(renderSize - footprint));
+                uvec3 sum = uvec3(0u);
+                for (int dy = 0; dy < footprint; dy++) {
+                    for (int dx = 0; dx < footprint; dx++) {
+                        ivec2 p = base + ivec2(dx, dy);
+                        sum += uvec3(texelFetch(texInput, ivec3(p, 0), 0).r,
+                                     texelFetch(texInput, ivec3(p, 1), 0).r,
+                                     texelFetch(texInput, ivec3(p, 2), 0).r);
+                    }
+                }
+                return vec3(sum) / float(footprint * footprint);
+            }
+        )__CODE__";
+    else
+        histogramFunction = R"__CODE__(
+            uniform sampler2D texInput;
+            vec3 average(vec2 position) {
+                ivec2 base = clamp(ivec2(position * float(renderSize)) - footprint / 2, ivec2(0), ivec2(renderSize - footprint));
+                vec3 sum = vec3(0.0);
+                for (int dy = 0; dy < footprint; dy++) {
+                    for (int dx = 0; dx < footprint; dx++) {
+                        sum += texelFetch(texInput, base + ivec2(dx, dy), 0).rgb;
+                    }
+                }
+                return sum / float(footprint * footprint);
+            }
+        )__CODE__";
+    // displayed(): what the output pixel at vo_position shows, before the colormap
+    std::string displayedFunction = std::string(R"__CODE__(#version 330
+            uniform int renderSize;
+            uniform int footprint;
+            uniform int mirror;
+            uniform vec2 mirrorAxis;
+            in vec2 vo_position;
+
+        )__CODE__") +
+        histogramFunction + std::string(R"__CODE__(
+
+            vec3 displayed() {
+                vec3 color = average(vo_position);
+                if (mirror != 0) {
+                    // Only half of the c plane was sampled, fold in the mirror image
+                    color += average(mix(vo_position, 1.0 - vo_position, mirrorAxis));
+                }
+                return color;
+            }
+        )__CODE__");
+    std::string displayVertexShader = R"__CODE__(#version 330
             layout(location = 0) in vec2 a_position;
             out vec2 vo_position;
             void main () {
                 vo_position = (vec2(-a_position.y, a_position.x) + 1.0) / 2.0;
                 gl_Position = vec4(a_position, 0, 1);
             }
-        )__CODE__",
-        std::string(R"__CODE__(#version 330
-            uniform sampler2D texInput;
+        )__CODE__";
+
+    programDisplay = compile_shader_program(
+        displayVertexShader,
+        displayedFunction + std::string(R"__CODE__(
             uniform sampler2D texColor;
+            uniform sampler2D texMax;
             uniform float colormapSize;
             uniform float colormapScaler;
-            in vec2 vo_position;
+            uniform int normalizeMax;
             layout(location = 0) out vec4 frag_color;
 
             float xyz_rgb_curve(float r) {
@@ -333,8 +671,12 @@ BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options
 
             void main() {
                 float scale = colormapScaler * 4.0;
-                vec4 color = texture(texInput, vo_position);
-                vec3 v = min(vec3(1.0), sqrt(color.rgb / scale));
+                if (normalizeMax != 0) {
+                    // The brightest displayed band reaches the top of the colormap
+                    scale = max(texelFetch(texMax, ivec2(0), 0).r * colormapScaler, 1e-30);
+                }
+                vec3 color = displayed();
+                vec3 v = min(vec3(1.0), sqrt(color / scale));
                 vec3 cx = texture(texColor, vec2((v.x * (colormapSize - 0.5) + 0.5) / colormapSize, 1.0 / 6.0)).xyz;
                 vec3 cy = texture(texColor, vec2((v.y * (colormapSize - 0.5) + 0.5) / colormapSize, 0.5)).xyz;
                 vec3 cz = texture(texColor, vec2((v.z * (colormapSize - 0.5) + 0.5) / colormapSize, 5.0 / 6.0)).xyz;
@@ -343,6 +685,39 @@ BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options
             }
         )__CODE__"));
 
+    // Max reduction for normalizeMax: the first pass writes the largest band of
+    // every output pixel, the next ones halve the size down to one texel
+    programMaxFirst = compile_shader_program(
+        displayVertexShader,
+        displayedFunction + std::string(R"__CODE__(
+            layout(location = 0) out float frag_max;
+            void main() {
+                vec3 color = displayed();
+                frag_max = max(color.r, max(color.g, color.b));
+            }
+        )__CODE__"));
+    programMaxReduce = compile_shader_program(
+        R"__CODE__(#version 330
+            layout(location = 0) in vec2 a_position;
+            void main () {
+                gl_Position = vec4(a_position, 0, 1);
+            }
+        )__CODE__",
+        R"__CODE__(#version 330
+            uniform sampler2D texInput;
+            uniform ivec2 inputSize;
+            layout(location = 0) out float frag_max;
+            void main() {
+                ivec2 p = ivec2(gl_FragCoord.xy) * 2;
+                ivec2 last = inputSize - 1;
+                frag_max = max(max(texelFetch(texInput, min(p, last), 0).r, texelFetch(texInput, min(p + ivec2(1, 0), last), 0).r),
+                               max(texelFetch(texInput, min(p + ivec2(0, 1), last), 0).r, texelFetch(texInput, min(p + ivec2(1, 1), last), 0).r));
+            }
+        )__CODE__");
+    glGenFramebuffers(1, &maxFramebuffer);
+    maxOutputSize = 0;
+    normalizeMax = false;
+
     // Build full screen quad vertices
     glGenBuffers(1, &quadVertices);
     glBindBuffer(GL_ARRAY_BUFFER, quadVertices);
@@ -356,6 +731,127 @@ BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    programCompute = 0;
+    programResolve = 0;
+    histogramBuffer = 0;
+    frameIndex = 0;
+    if (engine == BUDDHABROT_ENGINE_COMPUTE)
+    {
+        // With the R32UI accumulator the counters go straight into its image
+        // and the storage buffer only holds the generated point count
+        bool image = accumulator == BUDDHABROT_ACCUMULATOR_R32UI;
+
+        // One invocation per sample, same orbit and band rules as the geometry
+        // shader. Weights are stochastically rounded to fixed point so the
+        // integer counters stay unbiased.
+        programCompute = compile_compute_program(std::string(image ? "#version 430\n#define COUNTER_IMAGE\n" : "#version 430\n") + std::string(R"__CODE__(
+            layout(local_size_x = 64) in;
+            layout(std430, binding = 0) readonly buffer Samples { float samples[]; };
+            layout(std430, binding = 1) buffer Histogram { uint counts[]; };
+#ifdef COUNTER_IMAGE
+            layout(r32ui, binding = 0) uniform uimage2DArray histogram;
+#endif
+            uniform int sampleCount;
+            uniform int sampleOffset;
+            uniform int renderSize;
+            uniform float counterScale;
+            uniform uint seed;
+            shared uint groupPoints;
+
+        )__CODE__") + options.fractal->getShaderFunction() + std::string(R"__CODE__(
+
+            uint hash(uint x) {
+                x ^= x >> 16;
+                x *= 0x7feb352du;
+                x ^= x >> 15;
+                x *= 0x846ca68bu;
+                x ^= x >> 16;
+                return x;
+            }
+
+            void main () {
+                if(gl_LocalInvocationIndex == 0u) groupPoints = 0u;
+                barrier();
+                uint index = uint(sampleOffset) + gl_GlobalInvocationID.x;
+                uint points = 0u;
+                if(index < uint(sampleCount)) {
+                    vec2 c = vec2(samples[index * 3u], samples[index * 3u + 1u]);
+                    float weight = samples[index * 3u + 2u] * counterScale;
+                    vec2 z = vec2(0);
+                    int diverge = 0;
+                    for(int i = 0; i < 256; i++) {
+                        z = fractal(z, c);
+                        if(z.x * z.x + z.y * z.y >= 16.0) {
+                            diverge = i;
+                            break;
+                        }
+                    }
+                    int band = diverge < 80 ? 0 : (diverge < 160 ? 1 : 2);
+                    uint random = hash(index ^ seed);
+                    z = vec2(0);
+                    for(int i = 0; i < diverge; i++) {
+                        z = fractal(z, c);
+                        if(i < 1) continue;
+                        points++;
+                        ivec2 pixel = ivec2(floor((fractal_projection(z, c) / 2.0 + 1.0) * 0.5 * float(renderSize)));
+                        if(any(lessThan(pixel, ivec2(0))) || any(greaterThanEqual(pixel, ivec2(renderSize)))) continue;
+                        random = random * 1664525u + 1013904223u;
+                        uint amount = uint(weight + float(random >> 8) * (1.0 / 16777216.0));
+#ifdef COUNTER_IMAGE
+                        imageAtomicAdd(histogram, ivec3(pixel, band), amount);
+#else
+                        atomicAdd(counts[(pixel.y * renderSize + pixel.x) * 3 + band], amount);
+#endif
+                    }
+                }
+                // Orbit points including those off screen, like GL_PRIMITIVES_GENERATED
+                atomicAdd(groupPoints, points);
+                barrier();
+#ifdef COUNTER_IMAGE
+                if(gl_LocalInvocationIndex == 0u) atomicAdd(counts[0], groupPoints);
+#else
+                if(gl_LocalInvocationIndex == 0u) atomicAdd(counts[renderSize * renderSize * 3], groupPoints);
+#endif
+            }
+        )__CODE__"));
+
+        // Without the R32UI accumulator, a resolve pass turns the counters into the float target
+        if (!image)
+        {
+            programResolve = compile_shader_program(
+                R"__CODE__(#version 430
+            layout(location = 0) in vec2 a_position;
+            void main () {
+                gl_Position = vec4(a_position, 0, 1);
+            }
+        )__CODE__",
+                R"__CODE__(#version 430
+            layout(std430, binding = 1) readonly buffer Histogram { uint counts[]; };
+            uniform int renderSize;
+            uniform float counterScale;
+            layout(location = 0) out vec4 v_color;
+            void main() {
+                ivec2 pixel = ivec2(gl_FragCoord.xy);
+                int i = (pixel.y * renderSize + pixel.x) * 3;
+                v_color = vec4(float(counts[i]), float(counts[i + 1]), float(counts[i + 2]), 0) / counterScale;
+            }
+        )__CODE__");
+        }
+
+        // Three counters per pixel and the generated point count at the end
+        size_t counters = image ? 1 : pixels * 3 + 1;
+        glGenBuffers(1, &histogramBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogramBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * counters, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        accumulatorBytes += sizeof(GLuint) * counters;
+    }
+
+    profiling = false;
+    glGenQueries(2, queries);
+    accumulateSeconds = 0;
+    pointsCount = 0;
+
     glGenTextures(1, &colormapTexture);
     glBindTexture(GL_TEXTURE_2D, colormapTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -364,11 +860,7 @@ BuddhabrotRenderer::BuddhabrotRenderer(const BuddhabrotRendererOptions &_options
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    float default_colormap[][8] = {
-        {0, 0, 0, 0, 0, 0.3},
-        {0, 0, 0, 0, 0.3, 0},
-        {0, 0, 0, 0.3, 0, 0}};
-    setColormap(default_colormap[0], default_colormap[1], default_colormap[2], 2);
+    setDefaultColormap();
 
     scaler = 1;
 
@@ -379,6 +871,15 @@ void BuddhabrotRenderer::setScaler(float _scaler)
 {
     scaler = _scaler;
 }
+void BuddhabrotRenderer::setDefaultColormap()
+{
+    float default_colormap[][8] = {
+        {0, 0, 0, 0, 0, 0.3},
+        {0, 0, 0, 0, 0.3, 0},
+        {0, 0, 0, 0.3, 0, 0}};
+    setColormap(default_colormap[0], default_colormap[1], default_colormap[2], 2);
+}
+
 void BuddhabrotRenderer::setColormap(float *cm1, float *cm2, float *cm3, int length)
 {
     float *data = new float[length * 18];
@@ -404,50 +905,314 @@ void BuddhabrotRenderer::setColormap(float *cm1, float *cm2, float *cm3, int len
 
 void BuddhabrotRenderer::render(int x, int y, int width, int height)
 {
-    glViewport(x, y, width, height);
+    accumulate();
+    display(x, y, width, height);
+}
+
+void BuddhabrotRenderer::accumulate()
+{
     glDisable(GL_DEPTH_TEST);
     sampler.render();
 
+    if (profiling)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+        if (engine == BUDDHABROT_ENGINE_GEOMETRY)
+            glBeginQuery(GL_PRIMITIVES_GENERATED, queries[1]);
+    }
+    if (engine == BUDDHABROT_ENGINE_COMPUTE)
+        accumulateCompute();
+    else
+        accumulateGeometry();
+    if (profiling)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed = 0, points = 0;
+        if (engine == BUDDHABROT_ENGINE_GEOMETRY)
+        {
+            glEndQuery(GL_PRIMITIVES_GENERATED);
+            glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &points);
+        }
+        else
+        {
+            // The point count follows the counters, or is all there is with the R32UI accumulator
+            size_t index = accumulator == BUDDHABROT_ACCUMULATOR_R32UI ? 0 : (size_t)options.renderSize * options.renderSize * 3;
+            GLuint count = 0;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogramBuffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * index, sizeof(GLuint), &count);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            points = count;
+        }
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &elapsed);
+        accumulateSeconds = elapsed * 1e-9;
+        pointsCount = points;
+    }
+}
+
+void BuddhabrotRenderer::clearCounters()
+{
+    const GLuint zero[4] = {0, 0, 0, 0};
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClearBufferuiv(GL_COLOR, 0, zero);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindImageTexture(0, framebufferTexture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+}
+
+void BuddhabrotRenderer::accumulateCompute()
+{
+    bool image = accumulator == BUDDHABROT_ACCUMULATOR_R32UI;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogramBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, histogramBuffer);
+    if (image)
+        clearCounters();
+
+    glUseProgram(programCompute);
+    options.fractal->setShaderUniforms(programCompute);
+    glUniform1i(glGetUniformLocation(programCompute, "renderSize"), options.renderSize);
+    glUniform1f(glGetUniformLocation(programCompute, "counterScale"), CounterScale);
+    // Unchunked budgets can need more groups than one dispatch allows
+    GLint maxGroups;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroups);
+    sampler.beginSamples();
+    int count;
+    while ((count = sampler.nextSamples()) > 0)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sampler.getBuffer());
+        glUniform1i(glGetUniformLocation(programCompute, "sampleCount"), count);
+        glUniform1ui(glGetUniformLocation(programCompute, "seed"), frameIndex++ * 0x9e3779b9U);
+        int groups = (count + 63) / 64;
+        for (int offset = 0; offset < groups; offset += maxGroups)
+        {
+            glUniform1i(glGetUniformLocation(programCompute, "sampleOffset"), offset * 64);
+            glDispatchCompute(std::min(groups - offset, (int)maxGroups), 1, 1);
+        }
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    if (image)
+    {
+        glUseProgram(0);
+        glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+        return;
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Resolve the counters into the float target that display() reads
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, options.renderSize, options.renderSize);
+    glUseProgram(programResolve);
+    glUniform1i(glGetUniformLocation(programResolve, "renderSize"), options.renderSize);
+    glUniform1f(glGetUniformLocation(programResolve, "counterScale"), CounterScale);
+    glBindVertexArray(vertexArrayQuad);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+}
+
+void BuddhabrotRenderer::accumulateGeometry()
+{
+    bool image = accumulator == BUDDHABROT_ACCUMULATOR_R32UI;
+    if (image)
+        clearCounters();
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (image)
+    {
+        // Fragments only add to the counters through the image
+        glDrawBuffer(GL_NONE);
+    }
+    else
+    {
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+    }
     glViewport(0, 0, options.renderSize, options.renderSize);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
     glUseProgram(program);
     glBindVertexArray(vertexArray);
     options.fractal->setShaderUniforms(program);
-    sampler.sample();
-    glDrawArrays(GL_POINTS, 0, sampler.getSamplesCount());
+    if (image)
+        glUniform1f(glGetUniformLocation(program, "counterScale"), CounterScale);
+    sampler.beginSamples();
+    int count;
+    while ((count = sampler.nextSamples()) > 0)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, sampler.getBuffer());
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if (image)
+            glUniform1ui(glGetUniformLocation(program, "seed"), frameIndex++ * 0x9e3779b9U);
+        glDrawArrays(GL_POINTS, 0, count);
+    }
     glBindVertexArray(0);
     glUseProgram(0);
+    if (image)
+    {
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_BLEND);
+}
+
+void BuddhabrotRenderer::setDisplayedUniforms(GLuint program, int outputSize)
+{
+    glUniform1i(glGetUniformLocation(program, "texInput"), 0);
+    // The box filter averages as many texels as the target has per output pixel
+    glUniform1i(glGetUniformLocation(program, "renderSize"), options.renderSize);
+    glUniform1i(glGetUniformLocation(program, "footprint"), std::max(1, (options.renderSize + outputSize - 1) / outputSize));
+    int symmetry = sampler.getSymmetry();
+    glUniform1i(glGetUniformLocation(program, "mirror"), symmetry != FRACTAL_SYMMETRY_NONE);
+    glUniform2f(glGetUniformLocation(program, "mirrorAxis"), symmetry == FRACTAL_SYMMETRY_MIRROR_X, symmetry == FRACTAL_SYMMETRY_MIRROR_Y);
+}
+
+void BuddhabrotRenderer::reduceMax(int outputSize)
+{
+    if (outputSize != maxOutputSize)
+    {
+        glDeleteTextures(maxTextures.size(), maxTextures.data());
+        maxTextures.clear();
+        maxSizes.clear();
+        for (int size = outputSize;; size = (size + 1) / 2)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size, size, 0, GL_RED, GL_FLOAT, nullptr);
+            maxTextures.push_back(texture);
+            maxSizes.push_back(size);
+            if (size == 1)
+                break;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        maxOutputSize = outputSize;
+    }
+
+    // display() draws into whatever framebuffer the caller bound
+    GLint previous;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_FRAMEBUFFER, maxFramebuffer);
+    glBindVertexArray(vertexArrayQuad);
+    glActiveTexture(GL_TEXTURE0);
+    for (size_t level = 0; level < maxTextures.size(); level++)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, maxTextures[level], 0);
+        glViewport(0, 0, maxSizes[level], maxSizes[level]);
+        if (level == 0)
+        {
+            glUseProgram(programMaxFirst);
+            setDisplayedUniforms(programMaxFirst, outputSize);
+            glBindTexture(accumulator == BUDDHABROT_ACCUMULATOR_R32UI ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, framebufferTexture);
+        }
+        else
+        {
+            glUseProgram(programMaxReduce);
+            glUniform1i(glGetUniformLocation(programMaxReduce, "texInput"), 0);
+            glUniform2i(glGetUniformLocation(programMaxReduce, "inputSize"), maxSizes[level - 1], maxSizes[level - 1]);
+            glBindTexture(GL_TEXTURE_2D, maxTextures[level - 1]);
+        }
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindTexture(level == 0 && accumulator == BUDDHABROT_ACCUMULATOR_R32UI ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, 0);
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+}
+
+void BuddhabrotRenderer::display(int x, int y, int width, int height)
+{
+    int outputSize = std::max(1, std::min(width, height));
+    if (normalizeMax)
+        reduceMax(outputSize);
 
     glViewport(x, y, width, height);
 
-    glDisable(GL_BLEND);
     glUseProgram(programDisplay);
-    glUniform1i(glGetUniformLocation(programDisplay, "texInput"), 0);
+    setDisplayedUniforms(programDisplay, outputSize);
     glUniform1i(glGetUniformLocation(programDisplay, "texColor"), 1);
+    glUniform1i(glGetUniformLocation(programDisplay, "texMax"), 2);
     glUniform1f(glGetUniformLocation(programDisplay, "colormapSize"), colormapLength);
-    int accumulateScaler = 1;
-    float colormapScaler = scaler * (options.renderIterations - 4) / 1000.0 * accumulateScaler;
-    colormapScaler /= 256.0 * 256.0 / (options.samplerSize >> options.samplerMipmapLevel) / (options.samplerSize >> options.samplerMipmapLevel);
-    glUniform1f(glGetUniformLocation(programDisplay, "colormapScaler"), colormapScaler);
+    glUniform1i(glGetUniformLocation(programDisplay, "normalizeMax"), normalizeMax);
+    if (normalizeMax)
+    {
+        glUniform1f(glGetUniformLocation(programDisplay, "colormapScaler"), scaler);
+    }
+    else
+    {
+        // Integer counters are in units of 1 / CounterScale
+        int accumulateScaler = accumulator == BUDDHABROT_ACCUMULATOR_R32UI ? CounterScale : 1;
+        float colormapScaler = scaler * (options.renderIterations - 4) / 1000.0 * accumulateScaler;
+        colormapScaler /= 256.0 * 256.0 / (options.samplerSize >> options.samplerMipmapLevel) / (options.samplerSize >> options.samplerMipmapLevel);
+        glUniform1f(glGetUniformLocation(programDisplay, "colormapScaler"), colormapScaler);
+    }
+    GLenum target = accumulator == BUDDHABROT_ACCUMULATOR_R32UI ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, framebufferTexture);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(target, framebufferTexture);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, colormapTexture);
+    if (normalizeMax)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, maxTextures.back());
+    }
     glBindVertexArray(vertexArrayQuad);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     glBindVertexArray(0);
     glUseProgram(0);
+    if (normalizeMax)
+    {
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE1);
+    }
     glBindTexture(GL_TEXTURE_2D, 0);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(target, 0);
+}
+
+void BuddhabrotRenderer::readHistogram(float *data)
+{
+    if (accumulator == BUDDHABROT_ACCUMULATOR_R32UI)
+    {
+        // Band-major counters to interleaved RGB
+        size_t pixels = (size_t)options.renderSize * options.renderSize;
+        std::vector<GLuint> counts(pixels * 3);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, framebufferTexture);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &counts[0]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (size_t i = 0; i < pixels; i++)
+        {
+            for (int k = 0; k < 3; k++)
+                data[i * 3 + k] = counts[k * pixels + i] / (float)CounterScale;
+        }
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, framebufferTexture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, data);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    mirror_histogram(data, options.renderSize, sampler.getSymmetry());
 }
 
 BuddhabrotRenderer::~BuddhabrotRenderer()
 {
-}
\ No newline at end of file
+    if (engine == BUDDHABROT_ENGINE_COMPUTE)
+    {
+        glDeleteProgram(programCompute);
+        glDeleteProgram(programResolve);
+        glDeleteBuffers(1, &histogramBuffer);
+    }
+    glDeleteQueries(2, queries);
+    glDeleteProgram(programMaxFirst);
+    glDeleteProgram(programMaxReduce);
+    glDeleteFramebuffers(1, &maxFramebuffer);
+    glDeleteTextures(maxTextures.size(), maxTextures.data());
+}
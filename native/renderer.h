@@ -1,9 +1,31 @@
 #ifndef BUDDHABROT_RENDERER_RENDERER_H
 #define BUDDHABROT_RENDERER_RENDERER_H
 
+#include <vector>
+
 #include "opengl.h"
 #include "fractal.h"
 #include "sampler.h"
+#include "importance_cache.h"
+#include "seed_database.h"
+
+// Accumulation engines, BuddhabrotRendererOptions::engine
+// Geometry shader emits every orbit point, additively blended into a float target
+#define BUDDHABROT_ENGINE_GEOMETRY 0
+// Compute shader iterates orbits and adds fixed-point counts with integer atomics
+// into a storage buffer, resolved into the float target (needs OpenGL 4.3)
+#define BUDDHABROT_ENGINE_COMPUTE 1
+
+// Accumulation targets, BuddhabrotRendererOptions::accumulator
+// Float counts per band, alpha unused (16 bytes per pixel)
+#define BUDDHABROT_ACCUMULATOR_RGBA32F 0
+// Half-float counts for previews (6 bytes per pixel). Blending rounds to an
+// 11-bit significand, so increments below half an ulp are lost: a pixel stops
+// growing at about 2048 times the weight of one orbit point.
+#define BUDDHABROT_ACCUMULATOR_RGB16F 1
+// One fixed-point counter per band added with image atomics, 3-layer R32UI
+// array (12 bytes per pixel, needs OpenGL 4.2)
+#define BUDDHABROT_ACCUMULATOR_R32UI 2
 
 struct BuddhabrotRendererOptions
 {
@@ -11,22 +33,63 @@ struct BuddhabrotRendererOptions
     int samplerMipmapLevel;
     int samplerMaxIterations;
     int samplerLowerBound;
+    // Samples per streamed chunk, 0 to generate the whole frame at once
+    int samplerChunkSize;
+    // One of the SAMPLER_JITTER_* modes
+    int samplerJitter;
+    // Adaptive importance from the visible points of earlier frames' orbits,
+    // mixed over this many pyramid levels (0 disables) with the given strength in [0, 1].
+    // The CPU engine counts them on the orbits it draws; the GPU sampler has no
+    // per-sample readback and counts them on one probe orbit per importance pixel.
+    int samplerAdaptiveLevels;
+    float samplerAdaptiveStrength;
+    // Memory cap of the importance map cache (0 disables) and the parameter
+    // tolerance under which two fractals share a cached map
+    int importanceCacheBytes;
+    float importanceCacheTolerance;
+    // Seed database file (see seed_database.h) to sample from instead of the
+    // importance map while the orbit parameters match it, nullptr for none
+    const char *samplerSeedDatabase;
+    // Sample only half of the c plane and mirror the image when the fractal is
+    // conjugate-symmetric, falls back to the full plane otherwise
+    bool exploitSymmetry;
     int renderSize;
     int renderIterations;
+    // One of the BUDDHABROT_ENGINE_* engines, compute falls back to geometry without OpenGL 4.3
+    int engine;
+    // One of the BUDDHABROT_ACCUMULATOR_* formats, R32UI falls back to RGBA32F without OpenGL 4.2
+    int accumulator;
 
     Fractal *fractal;
 };
 
+// Fold an RGB histogram onto itself across the FRACTAL_SYMMETRY_* axis
+void mirror_histogram(float *data, int size, int symmetry);
+
 class BuddhabrotSampler
 {
   public:
-    BuddhabrotSampler(const BuddhabrotRendererOptions &options);
+    // sharedCache, if given, is used instead of a cache of the sampler's own;
+    // samplers sharing one must have the same samplerSize and samplerMipmapLevel
+    BuddhabrotSampler(const BuddhabrotRendererOptions &options, ImportanceCache *sharedCache = nullptr);
 
     void render();
-    void sample();
 
-    GLuint getBuffer() { return samplesBuffer; }
+    // Start a frame, then call nextSamples until it returns 0; each call fills
+    // getBuffer() with the next chunk and returns its sample count.
+    void beginSamples();
+    int nextSamples();
+
+    // Change the per-frame sample budget (samplerLowerBound)
+    void setLowerBound(int lowerBound);
+
+    GLuint getBuffer() { return samplesBuffers[currentBuffer]; }
     int getSamplesCount() { return samplesCount; }
+    // FRACTAL_SYMMETRY_* used by the last render(), the accumulation must be mirrored if set
+    int getSymmetry() { return symmetry; }
+    ImportanceCache &getCache() { return *cache; }
+    // Whether the last render() matched the seed database and skipped the importance map
+    bool isUsingSeeds() { return usingSeeds; }
 
     ~BuddhabrotSampler();
 
@@ -38,30 +101,81 @@ class BuddhabrotSampler
     GLuint quadVertices;
     GLuint vertexArray;
     GLuint program;
-    GLuint samplesBuffer;
+    static const int SamplesBufferCount = 3;
+    GLuint samplesBuffers[SamplesBufferCount];
+    int samplesBufferCapacity[SamplesBufferCount];
+    int currentBuffer;
     int samplesCount;
+    int symmetry;
 
     int mipmapSize;
     unsigned char *pixels;
     sampler_t *sampler;
+    ImportanceCache ownCache;
+    ImportanceCache *cache;
+    SeedDatabase *seeds;
+    bool usingSeeds;
 };
 
 class BuddhabrotRenderer
 {
   public:
-    BuddhabrotRenderer(const BuddhabrotRendererOptions &options);
+    BuddhabrotRenderer(const BuddhabrotRendererOptions &options, ImportanceCache *sharedCache = nullptr);
 
     void render(int x, int y, int width, int height);
 
+    // The two halves of render: fill the accumulation texture, then colormap it
+    // into the current framebuffer
+    void accumulate();
+    void display(int x, int y, int width, int height);
+
+    // Read back the accumulated renderSize x renderSize RGB histogram
+    void readHistogram(float *data);
+    int getSamplesCount() { return sampler.getSamplesCount(); }
+    BuddhabrotSampler &getSampler() { return sampler; }
+    // Engine and accumulator format in use after the fallback checks
+    int getEngine() { return engine; }
+    int getAccumulator() { return accumulator; }
+    // GPU memory of the accumulation target and the compute engine's counters
+    size_t getAccumulatorBytes() { return accumulatorBytes; }
+
+    // Time accumulate() on the GPU and count the orbit points it generated;
+    // reading the queries back stalls the pipeline, so this is for benchmarks
+    void setProfiling(bool profiling) { this->profiling = profiling; }
+    double getAccumulateSeconds() { return accumulateSeconds; }
+    long long getPointsCount() { return pointsCount; }
+
     void setScaler(float scaler);
+    // Normalize the display by the brightest displayed band, found by a max
+    // reduction over the output pixels every display(), instead of the fixed
+    // scale derived from the sample budget; the scaler then multiplies the max
+    void setNormalizeMax(bool normalizeMax) { this->normalizeMax = normalizeMax; }
+    void setLowerBound(int lowerBound) { sampler.setLowerBound(lowerBound); }
     void setColormap(float *cm1, float *cm2, float *cm3, int length);
+    void setDefaultColormap();
 
     ~BuddhabrotRenderer();
 
+    // Fixed-point scale of the compute engine's and the R32UI accumulator's counters
+    static const int CounterScale = 4096;
+
   private:
+    void accumulateGeometry();
+    void accumulateCompute();
+    // Zero the R32UI counters and bind them to image unit 0
+    void clearCounters();
+    // Uniforms of displayed(), shared by the display and the first max pass
+    void setDisplayedUniforms(GLuint program, int outputSize);
+    // Reduce the displayed image of outputSize x outputSize to its max in maxTextures.back()
+    void reduceMax(int outputSize);
+
     BuddhabrotRendererOptions options;
     BuddhabrotSampler sampler;
+    int engine;
+    int accumulator;
+    size_t accumulatorBytes;
     GLuint framebuffer;
+    // GL_TEXTURE_2D, or a GL_TEXTURE_2D_ARRAY with one layer per band for R32UI
     GLuint framebufferTexture;
     GLuint vertexArray;
     GLuint program;
@@ -69,9 +183,28 @@ class BuddhabrotRenderer
     GLuint quadVertices;
     GLuint vertexArrayQuad;
 
+    GLuint programCompute;
+    GLuint programResolve;
+    GLuint histogramBuffer;
+    unsigned int frameIndex;
+
+    bool profiling;
+    GLuint queries[2];
+    double accumulateSeconds;
+    long long pointsCount;
+
     float scaler;
     int colormapLength;
 
+    bool normalizeMax;
+    GLuint programMaxFirst;
+    GLuint programMaxReduce;
+    GLuint maxFramebuffer;
+    // Reduction levels, outputSize down to 1 x 1
+    std::vector<GLuint> maxTextures;
+    std::vector<int> maxSizes;
+    int maxOutputSize;
+
     GLuint colormapTexture;
 };
 
@@ -1,19 +1,51 @@
 #include "sampler.h"
 #include <math.h>
 #include <random>
+#include <vector>
 
-std::mt19937_64 rng(0);
-std::uniform_real_distribution<float> unif;
+// How much of the contribution history carries over to the next batch
+#define SAMPLER_ADAPTIVE_DECAY 0.75f
 
 struct sampler_t
 {
     int width;
     int height;
     int lower_bound;
+    // Only sample rows with c.y >= 0, for conjugate-symmetric fractals
+    bool half_plane;
     unsigned char *buffer;
     float *samples;
     int samples_size;
     int samples_count;
+
+    // Cursor for sampler_sample_into, set up by sampler_prepare
+    int multipler;
+    int first_cell;
+    int cursor_cell;
+    int cursor_index;
+
+    // Generator state, together with the cursor this fully determines the next chunk
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<float> unif;
+
+    float *chunk;
+    int chunk_size;
+
+    int jitter;
+    // Per-frame scramble, drawn in sampler_prepare so resumed calls stay deterministic
+    unsigned int frame_seed;
+    float frame_shift_x;
+    float frame_shift_y;
+
+    // Adaptive importance: per-cell visible orbit points reported by the caller,
+    // accumulated over batches and mixed into the importance across pyramid levels
+    bool adaptive;
+    int adaptive_levels;
+    float adaptive_floor;
+    unsigned char *contribution;
+    float *history;
+    // Per-cell sample counts for this frame, used when adaptive
+    int *counts;
 };
 
 sampler_t *sampler_create()
@@ -22,10 +54,28 @@ sampler_t *sampler_create()
     r->width = 0;
     r->height = 0;
     r->lower_bound = 1;
+    r->half_plane = false;
     r->buffer = nullptr;
     r->samples = nullptr;
     r->samples_size = 0;
     r->samples_count = 0;
+    r->multipler = 1;
+    r->first_cell = 0;
+    r->cursor_cell = 0;
+    r->cursor_index = 0;
+    r->rng.seed(0);
+    r->chunk = nullptr;
+    r->chunk_size = 0;
+    r->jitter = SAMPLER_JITTER_GAUSSIAN;
+    r->frame_seed = 0;
+    r->frame_shift_x = 0;
+    r->frame_shift_y = 0;
+    r->adaptive = false;
+    r->adaptive_levels = 1;
+    r->adaptive_floor = 1;
+    r->contribution = nullptr;
+    r->history = nullptr;
+    r->counts = nullptr;
     return r;
 }
 
@@ -34,6 +84,29 @@ void sampler_set_lower_bound(sampler_t *sampler, int lower_bound)
     sampler->lower_bound = lower_bound;
 }
 
+void sampler_set_half_plane(sampler_t *sampler, int half_plane)
+{
+    sampler->half_plane = half_plane != 0;
+}
+
+void sampler_set_seed(sampler_t *sampler, int seed)
+{
+    sampler->rng.seed(seed);
+}
+
+void sampler_set_jitter(sampler_t *sampler, int jitter)
+{
+    sampler->jitter = jitter;
+}
+
+void sampler_set_chunk_size(sampler_t *sampler, int chunk_size)
+{
+    if (sampler->chunk != nullptr)
+        delete[] sampler->chunk;
+    sampler->chunk_size = chunk_size;
+    sampler->chunk = new float[chunk_size * 3];
+}
+
 void sampler_set_size(sampler_t *sampler, int width, int height)
 {
     sampler->width = width;
@@ -41,70 +114,334 @@ void sampler_set_size(sampler_t *sampler, int width, int height)
     if (sampler->buffer != nullptr)
         delete[] sampler->buffer;
     sampler->buffer = new unsigned char[width * height];
+    if (sampler->contribution != nullptr)
+    {
+        delete[] sampler->contribution;
+        delete[] sampler->history;
+        delete[] sampler->counts;
+    }
+    sampler->contribution = new unsigned char[width * height]();
+    sampler->history = new float[width * height]();
+    sampler->counts = new int[width * height]();
+}
+
+void sampler_set_adaptive(sampler_t *sampler, int levels, float strength)
+{
+    sampler->adaptive = levels > 0 && strength > 0;
+    sampler->adaptive_levels = levels;
+    sampler->adaptive_floor = 1 - strength;
 }
 
-inline float rand01()
+inline float rand01(sampler_t *sampler)
 {
     // return (float)rand() / (float)RAND_MAX;
-    return unif(rng);
+    return sampler->unif(sampler->rng);
 }
 
-inline float randn_bm()
+inline float randn_bm(std::mt19937_64 &rng, std::uniform_real_distribution<float> &unif)
 {
     float v1, v2, s;
     do
     {
-        v1 = 2.0f * rand01() - 1.0f;
-        v2 = 2.0f * rand01() - 1.0f;
+        v1 = 2.0f * unif(rng) - 1.0f;
+        v2 = 2.0f * unif(rng) - 1.0f;
         s = v1 * v1 + v2 * v2;
     } while (s >= 1.0f || s == 0.0f);
     s = sqrt((-2.0f * log(s)) / s) / 2.0f;
     return v1 * s;
 }
 
-void sampler_sample(sampler_t *sampler)
+inline unsigned int hash_uint(unsigned int x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline unsigned int reverse_bits(unsigned int x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffU) << 8) | ((x & 0xff00ff00U) >> 8);
+    x = ((x & 0x0f0f0f0fU) << 4) | ((x & 0xf0f0f0f0U) >> 4);
+    x = ((x & 0x33333333U) << 2) | ((x & 0xccccccccU) >> 2);
+    x = ((x & 0x55555555U) << 1) | ((x & 0xaaaaaaaaU) >> 1);
+    return x;
+}
+
+// Laine-Karras style hash, an approximation of Owen scrambling on bit-reversed input
+inline unsigned int owen_scramble(unsigned int x, unsigned int seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return reverse_bits(x);
+}
+
+// First two dimensions of the Sobol sequence
+inline void sobol2(unsigned int index, unsigned int &x, unsigned int &y)
+{
+    x = reverse_bits(index);
+    y = 0;
+    unsigned int v = 1U << 31;
+    for (; index != 0; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1)
+            y ^= v;
+    }
+}
+
+inline double fract(double x)
+{
+    return x - floor(x);
+}
+
+// R2 sequence constants, 1/phi2 and 1/phi2^2 with phi2 the plastic number
+const double R2_A1 = 0.7548776662466927;
+const double R2_A2 = 0.5698402909980532;
+
+// Stratified point j of a cell in [0, 1)^2; the cell index picks a decorrelated scramble
+inline void cell_jitter(sampler_t *sampler, int cell, int j, float &u, float &v)
+{
+    if (sampler->jitter == SAMPLER_JITTER_SOBOL)
+    {
+        unsigned int seed = hash_uint(cell ^ sampler->frame_seed);
+        unsigned int sx, sy;
+        sobol2(owen_scramble(j, seed), sx, sy);
+        u = owen_scramble(sx, hash_uint(seed + 1)) * (1.0f / 4294967296.0f);
+        v = owen_scramble(sy, hash_uint(seed + 2)) * (1.0f / 4294967296.0f);
+    }
+    else
+    {
+        // Each cell walks its own window of the sequence, starting at a hashed
+        // index, so neighbouring cells do not share offsets
+        double index = (double)hash_uint(cell ^ sampler->frame_seed) + j;
+        u = (float)fract(sampler->frame_shift_x + R2_A1 * index);
+        v = (float)fract(sampler->frame_shift_y + R2_A2 * index);
+    }
+    // Guard against rounding up to exactly 1
+    u = u < 1.0f ? u : 0.99999994f;
+    v = v < 1.0f ? v : 0.99999994f;
+}
+
+// Fill sampler->counts from the importance buffer scaled by the learned contribution.
+// Every cell with nonzero importance keeps at least one sample, and each sample is
+// weighted 1 / count, so the expected image does not depend on the mixing.
+int sampler_prepare_adaptive(sampler_t *sampler, int first_cell, int lower_bound)
+{
+    unsigned char *array = sampler->buffer;
+    int width = sampler->width, height = sampler->height;
+    int array_length = width * height;
+    for (int i = 0; i < array_length; i++)
+        sampler->history[i] = sampler->history[i] * SAMPLER_ADAPTIVE_DECAY + sampler->contribution[i];
+
+    // Pyramid of block means, coarse levels fill in cells whose probe orbits were unlucky
+    std::vector<std::vector<float>> levels(1, std::vector<float>(sampler->history, sampler->history + array_length));
+    std::vector<int> level_width(1, width), level_height(1, height);
+    for (int l = 1; l < sampler->adaptive_levels; l++)
+    {
+        int pw = level_width[l - 1], ph = level_height[l - 1];
+        int w = (pw + 1) / 2, h = (ph + 1) / 2;
+        std::vector<float> level(w * h);
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                float sum = 0;
+                int n = 0;
+                for (int dy = 0; dy < 2; dy++)
+                {
+                    for (int dx = 0; dx < 2; dx++)
+                    {
+                        int sx = x * 2 + dx, sy = y * 2 + dy;
+                        if (sx < pw && sy < ph)
+                        {
+                            sum += levels[l - 1][sy * pw + sx];
+                            n++;
+                        }
+                    }
+                }
+                level[y * w + x] = sum / n;
+            }
+        }
+        levels.push_back(level);
+        level_width.push_back(w);
+        level_height.push_back(h);
+    }
+
+    double weighted = 0, base_total = 0;
+    std::vector<float> mixed(array_length);
+    for (int i = first_cell; i < array_length; i++)
+    {
+        if (array[i] == 0)
+            continue;
+        int x = i % width, y = i / width;
+        float m = 0;
+        for (size_t l = 0; l < levels.size(); l++)
+            m += levels[l][(y >> l) * level_width[l] + (x >> l)];
+        // The importance already counts every orbit point, so the history is turned
+        // into the visible fraction of them
+        float fraction = m / levels.size() * (1 - SAMPLER_ADAPTIVE_DECAY) / array[i];
+        mixed[i] = fraction < 1 ? fraction : 1;
+        weighted += (double)array[i] * mixed[i];
+        base_total += array[i];
+    }
+    double mean = base_total > 0 ? weighted / base_total : 0;
+    float floor_weight = sampler->adaptive_floor;
+
+    double total = 0;
+    for (int i = first_cell; i < array_length; i++)
+    {
+        double a = mean > 0 ? floor_weight + (1 - floor_weight) * mixed[i] / mean : 1;
+        mixed[i] = (float)(array[i] * a);
+        total += mixed[i];
+    }
+    double multipler = total > 0 ? 1 + floor(lower_bound / total) : 1;
+    int count = 0;
+    for (int i = 0; i < array_length; i++)
+    {
+        int v = 0;
+        if (i >= first_cell && array[i] > 0)
+        {
+            v = (int)(mixed[i] * multipler + 0.5);
+            v = v < 1 ? 1 : v;
+        }
+        sampler->counts[i] = v;
+        count += v;
+    }
+    return count;
+}
+
+int sampler_prepare(sampler_t *sampler)
 {
     unsigned char *array = sampler->buffer;
     int array_length = sampler->width * sampler->height;
+    int first_cell = sampler->half_plane ? (sampler->height / 2) * sampler->width : 0;
     int total_value = 0;
-    for (int i = 0; i < array_length; i++)
+    for (int i = first_cell; i < array_length; i++)
     {
         int v = array[i];
         total_value += v;
     }
-    int multipler = 1 + sampler->lower_bound / total_value;
-    total_value *= multipler;
-    if (sampler->samples == nullptr || sampler->samples_size < total_value)
+    // The mirrored half covers the other half of the budget
+    int lower_bound = sampler->half_plane ? sampler->lower_bound / 2 : sampler->lower_bound;
+    int multipler = total_value > 0 ? 1 + lower_bound / total_value : 1;
+    sampler->multipler = multipler;
+    sampler->first_cell = first_cell;
+    sampler->cursor_cell = first_cell;
+    sampler->cursor_index = 0;
+    sampler->samples_count = total_value * multipler;
+    if (sampler->adaptive)
+        sampler->samples_count = sampler_prepare_adaptive(sampler, first_cell, lower_bound);
+    sampler->frame_seed = (unsigned int)sampler->rng();
+    sampler->frame_shift_x = rand01(sampler);
+    sampler->frame_shift_y = rand01(sampler);
+    return sampler->samples_count;
+}
+
+// Write sample j of the v samples of cell i
+inline void sample_cell(sampler_t *sampler, std::mt19937_64 &rng, std::uniform_real_distribution<float> &unif, int i,
+                        int j, int v, float *output)
+{
+    float scale = 1.0f / sampler->width * 4;
+    float x = (i % sampler->width) * scale - 2;
+    float y = (i / sampler->width) * scale - 2;
+    float dx, dy;
+    if (sampler->jitter == SAMPLER_JITTER_GAUSSIAN)
     {
-        sampler->samples_size = total_value * 2;
-        sampler->samples = new float[sampler->samples_size * 3];
+        dx = (randn_bm(rng, unif) + 0.5) * scale;
+        dy = (randn_bm(rng, unif) + 0.5) * scale;
     }
-    float *samples = sampler->samples;
+    else
+    {
+        cell_jitter(sampler, i, j, dx, dy);
+        dx *= scale;
+        dy *= scale;
+    }
+    output[0] = x + dx;
+    output[1] = y + dy;
+    output[2] = 1.0 / v;
+}
+
+int sampler_sample_into(sampler_t *sampler, float *output, int capacity)
+{
+    unsigned char *array = sampler->buffer;
+    int array_length = sampler->width * sampler->height;
+    int multipler = sampler->multipler;
     int i_sample = 0;
-    int ix = 0;
-    int iy = 0;
-    float scale = 1.0f / sampler->width * 4;
-    for (int i = 0; i < array_length; i++)
+    int written = 0;
+    int i = sampler->cursor_cell;
+    int j = sampler->cursor_index;
+    while (i < array_length && written < capacity)
     {
-        int v = (array[i]) * multipler;
-        float x = ix * scale - 2;
-        float y = iy * scale - 2;
-        for (int j = 0; j < v; j++)
+        int v = sampler->adaptive ? sampler->counts[i] : (array[i]) * multipler;
+        for (; j < v && written < capacity; j++)
+        {
+            sample_cell(sampler, sampler->rng, sampler->unif, i, j, v, output + i_sample);
+            i_sample += 3;
+            written++;
+        }
+        if (j >= v)
         {
-            float dx = (randn_bm() + 0.5) * scale;
-            float dy = (randn_bm() + 0.5) * scale;
-            samples[i_sample++] = x + dx;
-            samples[i_sample++] = y + dy;
-            samples[i_sample++] = 1.0 / v;
+            i++;
+            j = 0;
         }
-        ix++;
-        if (ix >= sampler->width)
+    }
+    sampler->cursor_cell = i;
+    sampler->cursor_index = j;
+    return written;
+}
+
+int sampler_get_cell_samples(sampler_t *sampler, int cell)
+{
+    if (cell < sampler->first_cell)
+        return 0;
+    return sampler->adaptive ? sampler->counts[cell] : sampler->buffer[cell] * sampler->multipler;
+}
+
+int sampler_sample_cells(sampler_t *sampler, int first_cell, int end_cell, unsigned int range_seed, float *output)
+{
+    std::mt19937_64 rng(((unsigned long long)sampler->frame_seed << 32) | hash_uint(range_seed));
+    std::uniform_real_distribution<float> unif;
+    int written = 0;
+    for (int i = first_cell < sampler->first_cell ? sampler->first_cell : first_cell; i < end_cell; i++)
+    {
+        int v = sampler_get_cell_samples(sampler, i);
+        for (int j = 0; j < v; j++)
         {
-            ix = 0;
-            iy++;
+            sample_cell(sampler, rng, unif, i, j, v, output + written * 3);
+            written++;
         }
     }
-    sampler->samples_count = total_value;
+    return written;
+}
+
+void sampler_sample(sampler_t *sampler)
+{
+    int total_value = sampler_prepare(sampler);
+    if (sampler->samples == nullptr || sampler->samples_size < total_value)
+    {
+        if (sampler->samples != nullptr)
+            delete[] sampler->samples;
+        sampler->samples_size = total_value * 2;
+        sampler->samples = new float[sampler->samples_size * 3];
+    }
+    sampler_sample_into(sampler, sampler->samples, total_value);
+}
+
+int sampler_next_chunk(sampler_t *sampler)
+{
+    return sampler_sample_into(sampler, sampler->chunk, sampler->chunk_size);
+}
+
+float *sampler_get_chunk(sampler_t *sampler)
+{
+    return sampler->chunk;
 }
 
 float *sampler_get_samples(sampler_t *sampler)
@@ -122,11 +459,30 @@ unsigned char *sampler_get_buffer(sampler_t *sampler)
     return sampler->buffer;
 }
 
+unsigned char *sampler_get_contribution_buffer(sampler_t *sampler)
+{
+    return sampler->contribution;
+}
+
 void sampler_destroy(sampler_t *sampler)
 {
     if (sampler->samples)
     {
         delete[] sampler->samples;
     }
+    if (sampler->buffer)
+    {
+        delete[] sampler->buffer;
+    }
+    if (sampler->chunk)
+    {
+        delete[] sampler->chunk;
+    }
+    if (sampler->contribution)
+    {
+        delete[] sampler->contribution;
+        delete[] sampler->history;
+        delete[] sampler->counts;
+    }
     delete sampler;
 }
\ No newline at end of file
@@ -10,12 +10,52 @@
 
 struct sampler_t;
 
+// Placement of points inside an importance cell
+#define SAMPLER_JITTER_GAUSSIAN 0 // independent Gaussian offsets (default)
+#define SAMPLER_JITTER_R2 1       // R2 low-discrepancy sequence, stratified per cell
+#define SAMPLER_JITTER_SOBOL 2    // Owen-scrambled Sobol sequence, stratified per cell
+
 extern "C" {
 EXPORT sampler_t *sampler_create();
 EXPORT void sampler_set_size(sampler_t *sampler, int width, int height);
 EXPORT void sampler_set_lower_bound(sampler_t *sampler, int lower_bound);
+EXPORT void sampler_set_seed(sampler_t *sampler, int seed);
+// Sample only the upper half plane (c.y >= 0) with half the budget; the caller mirrors the result
+EXPORT void sampler_set_half_plane(sampler_t *sampler, int half_plane);
+EXPORT void sampler_set_jitter(sampler_t *sampler, int jitter);
 EXPORT void sampler_sample(sampler_t *sampler);
+
+// Zero-copy sampling: sampler_prepare scans the importance buffer and returns the
+// number of samples for this frame; sampler_sample_into then writes up to capacity
+// samples (3 floats each) into caller-owned memory and returns how many it wrote.
+// Call it repeatedly to resume where the previous call stopped; it returns 0 when done.
+EXPORT int sampler_prepare(sampler_t *sampler);
+EXPORT int sampler_sample_into(sampler_t *sampler, float *output, int capacity);
+
+// Streaming generator over sampler_sample_into with a fixed-size internal chunk, so
+// memory stays bounded by chunk_size regardless of the frame's sample count.
+// After sampler_prepare, each sampler_next_chunk fills sampler_get_chunk and returns
+// the number of samples in it, or 0 when the frame is exhausted.
+EXPORT void sampler_set_chunk_size(sampler_t *sampler, int chunk_size);
+EXPORT int sampler_next_chunk(sampler_t *sampler);
+EXPORT float *sampler_get_chunk(sampler_t *sampler);
 EXPORT unsigned char *sampler_get_buffer(sampler_t *sampler);
+
+// Parallel sampling: after sampler_prepare, sampler_get_cell_samples returns how many
+// samples a cell gets this frame and sampler_sample_cells writes all samples of cells
+// [first_cell, end_cell) into output, returning their count. Gaussian offsets come from
+// a generator seeded by the frame and range_seed instead of the shared one, so disjoint
+// ranges may be sampled concurrently, in any order. The cursor is left untouched.
+EXPORT int sampler_get_cell_samples(sampler_t *sampler, int cell);
+EXPORT int sampler_sample_cells(sampler_t *sampler, int first_cell, int end_cell, unsigned int range_seed, float *output);
+
+// Adaptive importance: before each sampler_prepare the caller fills the contribution
+// buffer (same size as the importance buffer) with how many visible points each
+// cell's orbits produced. The sampler keeps a decaying history of it, averages it
+// over `levels` pyramid levels and shifts up to `strength` of the budget towards
+// productive cells. Sample weights are corrected so the image stays unbiased.
+EXPORT void sampler_set_adaptive(sampler_t *sampler, int levels, float strength);
+EXPORT unsigned char *sampler_get_contribution_buffer(sampler_t *sampler);
 EXPORT float *sampler_get_samples(sampler_t *sampler);
 EXPORT int sampler_get_samples_count(sampler_t *sampler);
 EXPORT void sampler_destroy(sampler_t *sampler);
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "seed_database.h"
+
+static const char SeedMagic[8] = {'B', 'B', 'S', 'E', 'E', 'D', 'S', 0};
+
+inline uint32_t seed_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Interleave the bits of two 16-bit coordinates
+inline uint32_t morton2(uint32_t x, uint32_t y)
+{
+    uint32_t v[2] = {x & 0xffff, y & 0xffff};
+    for (int k = 0; k < 2; k++)
+    {
+        v[k] = (v[k] | (v[k] << 8)) & 0x00ff00ff;
+        v[k] = (v[k] | (v[k] << 4)) & 0x0f0f0f0f;
+        v[k] = (v[k] | (v[k] << 2)) & 0x33333333;
+        v[k] = (v[k] | (v[k] << 1)) & 0x55555555;
+    }
+    return v[0] | (v[1] << 1);
+}
+
+inline uint32_t seed_morton(const SeedRecord &r)
+{
+    return morton2((uint32_t)((r.cx + 2.0f) * 16384.0f), (uint32_t)((r.cy + 2.0f) * 16384.0f));
+}
+
+SeedDatabase::SeedDatabase(const std::string &path)
+{
+    header = nullptr;
+    records = nullptr;
+    mapping = nullptr;
+    mappingLength = 0;
+    samplesCount = 0;
+    cursor = 0;
+    nextGeneration = 0;
+    warned = false;
+    selected = 0;
+    stride = 1;
+    position = 0;
+    weight = 0;
+
+    fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SeedFileHeader))
+    {
+        std::cerr << "seed database: cannot open " << path << std::endl;
+        return;
+    }
+    mappingLength = st.st_size;
+    mapping = mmap(nullptr, mappingLength, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        std::cerr << "seed database: cannot map " << path << std::endl;
+        mapping = nullptr;
+        return;
+    }
+    const SeedFileHeader *h = (const SeedFileHeader *)mapping;
+    if (memcmp(h->magic, SeedMagic, 8) != 0 || h->version != Version || h->generations < 1 ||
+        h->generations > SEED_MAX_GENERATIONS || h->generationStart[h->generations] != h->count ||
+        sizeof(SeedFileHeader) + h->count * sizeof(SeedRecord) > mappingLength)
+    {
+        std::cerr << "seed database: " << path << " is not a version " << Version << " seed database" << std::endl;
+        return;
+    }
+    // Frames walk the records front to back with a large stride
+    madvise(mapping, mappingLength, MADV_WILLNEED);
+    header = h;
+    records = (const SeedRecord *)(h + 1);
+}
+
+int SeedDatabase::prepare(int budget, double cellArea)
+{
+    // As many generations as the budget can sample, the next ones in turn
+    long long count = header->count;
+    int generations = header->generations;
+    int m = generations;
+    if (budget < count)
+        m = std::max(1, std::min(generations, (int)ceil((double)budget * generations / count)));
+    else if (!warned)
+    {
+        std::cerr << "seed database: budget " << budget << " exceeds its " << count
+                  << " seeds, every frame samples all of them" << std::endl;
+        warned = true;
+    }
+    ranges.clear();
+    selected = 0;
+    for (int j = 0; j < m; j++)
+    {
+        int g = (nextGeneration + j) % generations;
+        ranges.push_back(std::make_pair((long long)header->generationStart[g], (long long)header->generationStart[g + 1]));
+        selected += ranges.back().second - ranges.back().first;
+    }
+    nextGeneration = (nextGeneration + m) % generations;
+
+    samplesCount = selected == 0 ? 0 : (int)std::min<long long>(budget, selected);
+    cursor = 0;
+    if (samplesCount == 0)
+        return 0;
+    stride = (double)selected / samplesCount;
+    position = std::uniform_real_distribution<double>(0, stride)(rng);
+    // Every generation is a complete estimate, m of them are averaged
+    weight = (float)(stride * header->seedArea / cellArea / m);
+    return samplesCount;
+}
+
+int SeedDatabase::sampleInto(float *output, int capacity)
+{
+    int written = sampleRange(cursor, (int)std::min<long long>((long long)cursor + capacity, samplesCount), output);
+    cursor += written;
+    return written;
+}
+
+int SeedDatabase::sampleRange(int first, int end, float *output) const
+{
+    size_t range = 0;
+    long long rangeOffset = 0;
+    int written = 0;
+    for (int i = first; i < end && i < samplesCount; i++)
+    {
+        // Rounding can land the last index on selected itself
+        long long index = std::min((long long)(position + i * stride), selected - 1);
+        while (index >= rangeOffset + ranges[range].second - ranges[range].first)
+        {
+            rangeOffset += ranges[range].second - ranges[range].first;
+            range++;
+        }
+        const SeedRecord &r = records[ranges[range].first + index - rangeOffset];
+        output[written * 3 + 0] = r.cx;
+        output[written * 3 + 1] = r.cy;
+        output[written * 3 + 2] = weight;
+        written++;
+    }
+    return written;
+}
+
+void SeedDatabase::generate(TaskPool &pool, const FractalTransform &t, const SeedGrid &grid, bool halfPlane,
+                            unsigned int seed, std::vector<SeedRecord> &output, double &seedArea)
+{
+    // Importance cells the sampler would draw from: the escape map at the
+    // sampler's pixel centers, box-filtered to its mipmap level like
+    // BuddhabrotCPURenderer::renderImportance
+    int size = grid.samplerSize;
+    int block = 1 << grid.samplerMipmapLevel;
+    int cells = size / block;
+    std::vector<unsigned char> escapes((size_t)size * size);
+    pool.parallelFor(size, [&](int begin, int end, int) {
+        for (int py = begin; py < end; py++)
+        {
+            for (int px = 0; px < size; px++)
+            {
+                int visible;
+                float cx = (px + 0.5f) / size * 4.0f - 2.0f;
+                float cy = (py + 0.5f) / size * 4.0f - 2.0f;
+                escapes[py * size + px] = t.importanceEscape(cx, cy, grid.samplerMaxIterations, visible);
+            }
+        }
+    });
+    std::vector<bool> eligible((size_t)cells * cells);
+    for (int y = 0; y < cells; y++)
+    {
+        for (int x = 0; x < cells; x++)
+        {
+            int sum = 0;
+            for (int by = 0; by < block; by++)
+            {
+                for (int bx = 0; bx < block; bx++)
+                    sum += escapes[(y * block + by) * size + x * block + bx];
+            }
+            // The sampler only reads the c.y >= 0 half of a half-plane map
+            eligible[y * cells + x] = (sum + block * block / 2) / (block * block) > 0 && (!halfPlane || y >= cells / 2);
+        }
+    }
+
+    int resolution = grid.resolution;
+    double h = 4.0 / resolution;
+    seedArea = h * h;
+    int firstRow = halfPlane ? resolution / 2 : 0;
+    int rows = resolution - firstRow;
+    std::vector<std::vector<SeedRecord>> found(pool.getWorkerCount());
+    pool.parallelFor(rows * grid.generations, [&](int begin, int end, int worker) {
+        std::vector<SeedRecord> &records = found[worker];
+        for (int row = begin; row < end; row++)
+        {
+            int generation = row / rows;
+            int y = firstRow + row % rows;
+            for (int x = 0; x < resolution; x++)
+            {
+                // Jitter inside the grid cell, a function of the cell so the result
+                // does not depend on the task split
+                uint32_t r = seed_hash(seed ^ seed_hash(((uint32_t)generation * resolution + y) * resolution + x));
+                float cx = (float)(-2.0 + (x + (r & 0xffff) / 65536.0) * h);
+                float cy = (float)(-2.0 + (y + (r >> 16) / 65536.0) * h);
+                int cellX = std::min(cells - 1, (int)((cx + 2.0f) * 0.25f * cells));
+                int cellY = std::min(cells - 1, (int)((cy + 2.0f) * 0.25f * cells));
+                if (!eligible[cellY * cells + cellX])
+                    continue;
+                // Same divergence test as the accumulation pass, which draws
+                // iterations 1 to diverge - 1
+                float zx = 0, zy = 0;
+                int diverge = 0;
+                for (int i = 0; i < 256; i++)
+                {
+                    t.iterate(zx, zy, cx, cy);
+                    if (zx * zx + zy * zy >= 16.0f)
+                    {
+                        diverge = i;
+                        break;
+                    }
+                }
+                if (diverge < 2)
+                    continue;
+                SeedRecord record;
+                record.cx = cx;
+                record.cy = cy;
+                record.iteration = diverge;
+                record.band = diverge < 80 ? 0 : (diverge < 160 ? 1 : 2);
+                record.generation = generation;
+                records.push_back(record);
+            }
+        }
+    });
+    output.clear();
+    for (std::vector<SeedRecord> &records : found)
+        output.insert(output.end(), records.begin(), records.end());
+}
+
+bool SeedDatabase::write(const std::string &path, const std::string &key, int symmetry, const SeedGrid &grid,
+                         double seedArea, std::vector<SeedRecord> &records)
+{
+    std::sort(records.begin(), records.end(), [](const SeedRecord &a, const SeedRecord &b) {
+        if (a.generation != b.generation)
+            return a.generation < b.generation;
+        if (a.band != b.band)
+            return a.band < b.band;
+        if (a.iteration != b.iteration)
+            return a.iteration < b.iteration;
+        return seed_morton(a) < seed_morton(b);
+    });
+
+    SeedFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SeedMagic, 8);
+    header.version = Version;
+    header.symmetry = symmetry;
+    header.count = records.size();
+    header.generations = grid.generations;
+    header.samplerSize = grid.samplerSize;
+    header.samplerMipmapLevel = grid.samplerMipmapLevel;
+    header.samplerMaxIterations = grid.samplerMaxIterations;
+    header.seedArea = seedArea;
+    strncpy(header.key, key.c_str(), sizeof(header.key) - 1);
+    size_t start = 0;
+    for (int g = 0; g < grid.generations; g++)
+    {
+        while (start < records.size() && records[start].generation < g)
+            start++;
+        header.generationStart[g] = start;
+    }
+    header.generationStart[grid.generations] = records.size();
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "seed database: cannot write " << path << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && !records.empty())
+        ok = fwrite(&records[0], sizeof(SeedRecord), records.size(), file) == records.size();
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+SeedDatabase::~SeedDatabase()
+{
+    if (mapping != nullptr)
+        munmap(mapping, mappingLength);
+    if (fd >= 0)
+        close(fd);
+}
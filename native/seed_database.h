@@ -0,0 +1,135 @@
+#ifndef BUDDHABROT_RENDERER_SEED_DATABASE_H
+#define BUDDHABROT_RENDERER_SEED_DATABASE_H
+
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "fractal.h"
+#include "task_pool.h"
+
+// Precomputed orbit seeds for one set of orbit parameters.
+//
+// A seed database holds, for one or more independent jitters ("generations")
+// of a grid over [-2, 2]^2, every c that lies in a cell the importance sampler
+// would sample and whose orbit draws at least one point. Cells are chosen by
+// the importance map's own rule, so the seeds of one generation estimate the
+// same image as the importance sampler with jitter uniform in each cell; seeds
+// that draw nothing are left out, which does not change the estimate. The file
+// is memory-mapped and its records are sorted by generation, band, escape
+// iteration and Morton order of c, so a systematic sample with a fixed stride
+// from a random start is stratified over all of them and reads the file front
+// to back.
+//
+// Each frame samples k of the N seeds of m generations, taking turns through
+// the generations, and gives each sample the weight N / k * seedArea /
+// cellArea / m, which matches the scale of the importance sampler whose
+// samples add up to one per cell. A budget above the whole database samples
+// all of it every frame. The database only depends on the orbit, so it stays
+// valid while the projection rotates; it is looked up by getOrbitKey(tolerance).
+
+#define SEED_MAX_GENERATIONS 16
+
+// Grid a database is generated on, and the importance sampler settings that
+// decide which of its cells are sampled
+struct SeedGrid
+{
+    int resolution;
+    int generations;
+    int samplerSize;
+    int samplerMipmapLevel;
+    int samplerMaxIterations;
+};
+
+struct SeedRecord
+{
+    float cx, cy;
+    uint16_t iteration;
+    uint8_t band;
+    uint8_t generation;
+};
+
+struct SeedFileHeader
+{
+    char magic[8]; // "BBSEEDS\0"
+    uint32_t version;
+    // FRACTAL_SYMMETRY_* the seeds were generated for; when set only c.y >= 0 is stored
+    uint32_t symmetry;
+    uint64_t count;
+    uint32_t generations;
+    uint32_t samplerSize;
+    uint32_t samplerMipmapLevel;
+    uint32_t samplerMaxIterations;
+    // First record of each generation, generationStart[generations] == count
+    uint64_t generationStart[SEED_MAX_GENERATIONS + 1];
+    // Area of the c plane each seed stands for
+    double seedArea;
+    // Fractal::getOrbitKey of the parameters, zero padded
+    char key[256];
+};
+
+class SeedDatabase
+{
+  public:
+    // Map a database file, check isOpen() for errors
+    SeedDatabase(const std::string &path);
+
+    bool isOpen() { return header != nullptr; }
+    std::string getKey() { return std::string(header->key); }
+    int getSymmetry() { return header->symmetry; }
+    long long getCount() { return header->count; }
+    const SeedRecord *getRecords() { return records; }
+    // Whether the seeds were selected with the importance cells of this sampler
+    bool isCompatible(int samplerSize, int samplerMipmapLevel, int samplerMaxIterations)
+    {
+        return (int)header->samplerSize == samplerSize && (int)header->samplerMipmapLevel == samplerMipmapLevel &&
+               (int)header->samplerMaxIterations == samplerMaxIterations;
+    }
+
+    void setSeed(int seed) { rng.seed(seed); }
+
+    // Start a frame of at most budget samples and return their count; cellArea
+    // is the c plane area of one importance cell of the sampler it replaces
+    int prepare(int budget, double cellArea);
+    // Same contract as sampler_sample_into: resumable, returns 0 when done
+    int sampleInto(float *output, int capacity);
+    // Write samples [first, end) of this frame and return their count; the
+    // cursor is left untouched, so disjoint ranges may be sampled concurrently
+    int sampleRange(int first, int end, float *output) const;
+
+    ~SeedDatabase();
+
+    // Find the seeds of a fractal on grid.generations jitters of a
+    // grid.resolution x grid.resolution grid; with halfPlane only the c.y >= 0
+    // rows are kept
+    static void generate(TaskPool &pool, const FractalTransform &transform, const SeedGrid &grid, bool halfPlane,
+                         unsigned int seed, std::vector<SeedRecord> &records, double &seedArea);
+    // Sort the records and write a database file
+    static bool write(const std::string &path, const std::string &key, int symmetry, const SeedGrid &grid,
+                      double seedArea, std::vector<SeedRecord> &records);
+
+    static const int Version = 2;
+
+  private:
+    int fd;
+    void *mapping;
+    size_t mappingLength;
+    const SeedFileHeader *header;
+    const SeedRecord *records;
+
+    std::mt19937 rng;
+    // Record ranges of this frame's generations, and the generation the next frame starts at
+    std::vector<std::pair<long long, long long>> ranges;
+    int nextGeneration;
+    bool warned;
+    // Records in this frame's generations, the systematic sample strides over them
+    long long selected;
+    double stride;
+    double position;
+    float weight;
+    int samplesCount;
+    int cursor;
+};
+
+#endif
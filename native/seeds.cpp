@@ -0,0 +1,122 @@
+// Seed database builder.
+//
+// Finds every c on independently jittered resolution x resolution grids that
+// lies in a cell the importance sampler would sample and whose orbit draws a
+// point, for one parameter set, and writes them sorted into a file that the
+// renderer memory-maps with --seeds FILE (see seed_database.h). The database is
+// keyed by the orbit parameters only, so it can be reused while the projection
+// rotates.
+//
+// Usage: ./seeds --output FILE [--resolution N] [--generations N] [--sampler-size N]
+//                [--half-plane] [--tolerance X] [--seed N] [--threads N] [preset.json [INDEX]]
+//            without a preset file the default parameters are used;
+//            --generations sets the number of grid jitters (4, at most 16), frames
+//            whose budget exceeds one generation draw from several;
+//            --sampler-size must match the renderer's (512), it decides the cells;
+//            --half-plane stores only c.y >= 0 when the fractal is conjugate-symmetric
+
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "fractal.h"
+#include "presets.h"
+#include "seed_database.h"
+#include "task_pool.h"
+
+double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[])
+{
+    std::string output, presetFile;
+    int presetIndex = 0;
+    int resolution = 4096;
+    int generations = 4;
+    int samplerSize = 512;
+    bool halfPlane = false;
+    float tolerance = 1e-3f;
+    int seed = 1;
+    int threads = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--output" && hasValue)
+            output = argv[++i];
+        else if (arg == "--resolution" && hasValue)
+            resolution = atoi(argv[++i]);
+        else if (arg == "--generations" && hasValue)
+            generations = atoi(argv[++i]);
+        else if (arg == "--sampler-size" && hasValue)
+            samplerSize = atoi(argv[++i]);
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = atof(argv[++i]);
+        else if (arg == "--seed" && hasValue)
+            seed = atoi(argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            threads = atoi(argv[++i]);
+        else if (arg == "--half-plane")
+            halfPlane = true;
+        else if (arg.size() > 2 && arg.substr(0, 2) == "--")
+        {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return 2;
+        }
+        else if (presetFile.empty())
+            presetFile = arg;
+        else
+            presetIndex = atoi(arg.c_str());
+    }
+    if (output.empty() || resolution <= 0 || generations < 1 || generations > SEED_MAX_GENERATIONS || samplerSize < 2)
+    {
+        std::cerr << "usage: seeds --output FILE [--resolution N] [--generations N] [--sampler-size N] [--half-plane] "
+                     "[preset.json [INDEX]]"
+                  << std::endl;
+        return 2;
+    }
+
+    BuddhabrotFractal *fractal = Fractal::CreateBuddhabrot();
+    if (!presetFile.empty())
+    {
+        std::vector<BuddhabrotFractal::BuddhabrotFractalParameters> presets = load_presets(presetFile);
+        if (presetIndex < 0 || presetIndex >= (int)presets.size())
+        {
+            std::cerr << "no preset " << presetIndex << " in " << presetFile << std::endl;
+            return 2;
+        }
+        fractal->parameters = presets[presetIndex];
+    }
+
+    FractalTransform t = fractal->getTransform();
+    int symmetry = halfPlane ? t.getSymmetry() : FRACTAL_SYMMETRY_NONE;
+    if (halfPlane && symmetry == FRACTAL_SYMMETRY_NONE)
+        std::cerr << "parameters are not conjugate-symmetric, storing the full plane" << std::endl;
+
+    TaskPool pool(threads);
+    // Mipmap level and iterations of the renderer's importance sampler
+    SeedGrid grid = {resolution, generations, samplerSize, 1, 256};
+    std::vector<SeedRecord> records;
+    double seedArea;
+    double t0 = now();
+    SeedDatabase::generate(pool, t, grid, symmetry != FRACTAL_SYMMETRY_NONE, seed, records, seedArea);
+    double t1 = now();
+    if (!SeedDatabase::write(output, fractal->getOrbitKey(tolerance), symmetry, grid, seedArea, records))
+        return 1;
+    double t2 = now();
+
+    long long candidates = (long long)generations * resolution * (symmetry != FRACTAL_SYMMETRY_NONE ? resolution - resolution / 2 : resolution);
+    long long bands[3] = {0, 0, 0};
+    for (const SeedRecord &r : records)
+        bands[r.band]++;
+    std::cerr << records.size() << " seeds of " << candidates << " candidates (" << 100.0 * records.size() / candidates
+              << "%), bands " << bands[0] << " / " << bands[1] << " / " << bands[2] << std::endl;
+    std::cerr << "search " << t1 - t0 << " s, sort and write " << t2 - t1 << " s, "
+              << (sizeof(SeedFileHeader) + records.size() * sizeof(SeedRecord)) / 1048576.0 << " MB" << std::endl;
+    delete fractal;
+    return 0;
+}
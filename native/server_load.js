@@ -0,0 +1,117 @@
+// Load generator for ./renderer --serve SOCKET
+//
+// Usage: node server_load.js [socket] [connections] [seconds] [distinct] [size] [budget] [png|histogram]
+//
+// Each connection sends requests back to back, picking one of `distinct`
+// parameter sets from animation-1.json, and the run reports throughput and
+// latency percentiles as seen by the clients. Fewer distinct parameter sets
+// than connections exercises the server's batching.
+
+var net = require('net');
+
+var socketPath = process.argv[2] || '/tmp/buddhabrot.sock';
+var connections = parseInt(process.argv[3] || '8');
+var seconds = parseFloat(process.argv[4] || '10');
+var distinct = parseInt(process.argv[5] || '2');
+var size = parseInt(process.argv[6] || '512');
+var budget = parseInt(process.argv[7] || '100000');
+var format = process.argv[8] == 'histogram' ? 1 : 0;
+
+var REQUEST_MAGIC = 0x51524242;
+var RESPONSE_HEADER_SIZE = 32;
+
+var animation = require('./animation-1.json');
+var parameterNames = [
+  'z3_scaler', 'z3_angle', 'z3_yscale',
+  'z2_scaler', 'z2_angle', 'z2_yscale',
+  'z1_scaler', 'z1_angle', 'z1_yscale',
+  'rotation_zxcx', 'rotation_zxcy', 'rotation_zycx', 'rotation_zycy'
+];
+
+function make_request(id, params) {
+  var buf = Buffer.alloc(4 * 19);
+  var p = 0;
+  buf.writeUInt32LE(REQUEST_MAGIC, p); p += 4;
+  buf.writeUInt32LE(id, p); p += 4;
+  for (var i = 0; i < parameterNames.length; i++) {
+    buf.writeFloatLE(params[parameterNames[i]], p); p += 4;
+  }
+  buf.writeUInt32LE(size, p); p += 4;
+  buf.writeUInt32LE(budget, p); p += 4;
+  buf.writeUInt32LE(format, p); p += 4;
+  buf.writeUInt32LE(0, p); p += 4;
+  return buf;
+}
+
+var latencies = [];
+var batches = 0;
+var bytes = 0;
+var errors = 0;
+var nextId = 0;
+var t0 = Date.now();
+var running = connections;
+
+function start_connection() {
+  var socket = net.connect(socketPath);
+  var pending = Buffer.alloc(0);
+  var sent = 0;
+
+  function send() {
+    if (Date.now() - t0 > seconds * 1000) {
+      socket.end();
+      return;
+    }
+    var params = animation[Math.floor(Math.random() * distinct) % animation.length].parameters;
+    sent = process.hrtime();
+    socket.write(make_request(nextId++, params));
+  }
+
+  socket.on('connect', send);
+  socket.on('data', function (data) {
+    pending = Buffer.concat([pending, data]);
+    while (pending.length >= RESPONSE_HEADER_SIZE) {
+      var length = pending.readUInt32LE(28);
+      if (pending.length < RESPONSE_HEADER_SIZE + length)
+        return;
+      if (pending.readUInt32LE(8) != 0)
+        errors++;
+      var dt = process.hrtime(sent);
+      latencies.push(dt[0] * 1000 + dt[1] / 1e6);
+      batches += pending.readUInt32LE(20);
+      bytes += length;
+      pending = pending.slice(RESPONSE_HEADER_SIZE + length);
+      send();
+    }
+  });
+  socket.on('error', function (e) {
+    console.error(e.message);
+    errors++;
+  });
+  socket.on('close', function () {
+    if (--running == 0)
+      report();
+  });
+}
+
+function percentile(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function report() {
+  var elapsed = (Date.now() - t0) / 1000;
+  var sorted = latencies.slice().sort(function (a, b) { return a - b; });
+  console.log('requests: ' + sorted.length + ', errors: ' + errors);
+  console.log('throughput: ' + (sorted.length / elapsed).toFixed(1) + ' req/s, ' +
+    (bytes / elapsed / 1048576).toFixed(1) + ' MB/s');
+  if (sorted.length > 0) {
+    console.log('mean batch: ' + (batches / sorted.length).toFixed(2));
+    console.log('latency ms: p50 ' + percentile(sorted, 0.5).toFixed(1) +
+      ', p90 ' + percentile(sorted, 0.9).toFixed(1) +
+      ', p99 ' + percentile(sorted, 0.99).toFixed(1) +
+      ', max ' + sorted[sorted.length - 1].toFixed(1));
+  }
+}
+
+for (var i = 0; i < connections; i++) {
+  start_connection();
+}
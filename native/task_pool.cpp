@@ -0,0 +1,235 @@
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#endif
+
+#include "task_pool.h"
+
+inline double pool_time()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TaskPool::TaskPool(int threads, bool pin)
+{
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+    body = nullptr;
+    generation = 0;
+    remaining = 0;
+    active = 0;
+    stopping = false;
+    for (int i = 0; i < threads; i++)
+    {
+        workers.push_back(new Worker());
+        workers[i]->stats = WorkerStats();
+    }
+    for (int i = 1; i < threads; i++)
+        workers[i]->thread = std::thread([this, i] { workerLoop(i); });
+#ifdef __linux__
+    // Worker i goes to the i-th CPU the process may run on, which under
+    // taskset or a cgroup cpuset need not be CPU i
+    pinned = pin && sched_getaffinity(0, sizeof(callerAffinity), &callerAffinity) == 0;
+    if (pinned)
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &callerAffinity))
+                cpus.push_back(cpu);
+        for (int i = 0; i < threads && !cpus.empty(); i++)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpus.size()], &set);
+            pthread_t thread = i == 0 ? pthread_self() : workers[i]->thread.native_handle();
+            int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+            if (error != 0)
+                std::cerr << "task pool: could not pin worker " << i << " to cpu " << cpus[i % cpus.size()] << ": "
+                          << strerror(error) << std::endl;
+        }
+    }
+#endif
+}
+
+void TaskPool::parallelFor(int count, const Body &_body, const Cost &cost)
+{
+    if (count <= 0)
+        return;
+    int n = (int)workers.size();
+    int taskCount = n * TasksPerWorker;
+
+    // Cut [0, count) into tasks of about equal estimated cost
+    std::vector<Task> tasks;
+    if (cost)
+    {
+        double total = 0;
+        std::vector<float> costs(count);
+        for (int i = 0; i < count; i++)
+        {
+            costs[i] = cost(i);
+            total += costs[i];
+        }
+        double target = total / taskCount, accumulated = 0;
+        int begin = 0;
+        for (int i = 0; i < count; i++)
+        {
+            accumulated += costs[i];
+            if (accumulated >= target || i == count - 1)
+            {
+                tasks.push_back({begin, i + 1});
+                begin = i + 1;
+                accumulated = 0;
+            }
+        }
+    }
+    else
+    {
+        for (int t = 0; t < taskCount; t++)
+        {
+            int begin = (int)((long long)count * t / taskCount);
+            int end = (int)((long long)count * (t + 1) / taskCount);
+            if (end > begin)
+                tasks.push_back({begin, end});
+        }
+    }
+
+    // Deal contiguous runs of tasks to each worker, so neighbours share caches
+    for (int w = 0; w < n; w++)
+    {
+        size_t first = tasks.size() * w / n, last = tasks.size() * (w + 1) / n;
+        std::lock_guard<std::mutex> lock(workers[w]->mutex);
+        for (size_t t = first; t < last; t++)
+            workers[w]->tasks.push_back(tasks[t]);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        body = &_body;
+        remaining = (int)tasks.size();
+        active = n - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return remaining == 0 && active == 0; });
+    body = nullptr;
+}
+
+bool TaskPool::popTask(int index, Task &task, bool &stolen)
+{
+    Worker *self = workers[index];
+    {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (!self->tasks.empty())
+        {
+            task = self->tasks.front();
+            self->tasks.pop_front();
+            stolen = false;
+            return true;
+        }
+    }
+    // Steal from the back of the other deques, starting at the next worker
+    int n = (int)workers.size();
+    for (int k = 1; k < n; k++)
+    {
+        Worker *victim = workers[(index + k) % n];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty())
+        {
+            task = victim->tasks.back();
+            victim->tasks.pop_back();
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::runTasks(int index)
+{
+    Worker *self = workers[index];
+    Task task;
+    bool stolen;
+    while (popTask(index, task, stolen))
+    {
+        double t0 = pool_time();
+        (*body)(task.begin, task.end, index);
+        self->stats.busySeconds += pool_time() - t0;
+        self->stats.tasks++;
+        if (stolen)
+            self->stats.stolen++;
+        if (--remaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+void TaskPool::workerLoop(int index)
+{
+    long long seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        runTasks(index);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+        }
+        done.notify_all();
+    }
+}
+
+TaskPool::WorkerStats TaskPool::getStats(int worker)
+{
+    return workers[worker]->stats;
+}
+
+void TaskPool::resetStats()
+{
+    for (Worker *worker : workers)
+        worker->stats = WorkerStats();
+}
+
+void TaskPool::printStats(std::ostream &out)
+{
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        WorkerStats &stats = workers[i]->stats;
+        out << "worker " << i << ": " << stats.tasks << " tasks, " << stats.stolen << " stolen, "
+            << stats.busySeconds << " s busy" << std::endl;
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 1; i < workers.size(); i++)
+        workers[i]->thread.join();
+    for (Worker *worker : workers)
+        delete worker;
+#ifdef __linux__
+    if (pinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(callerAffinity), &callerAffinity);
+#endif
+}
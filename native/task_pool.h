@@ -0,0 +1,87 @@
+#ifndef BUDDHABROT_RENDERER_TASK_POOL_H
+#define BUDDHABROT_RENDERER_TASK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Work-stealing pool for the native CPU paths. Orbit cost ranges from one to
+// hundreds of iterations, so an even split of samples leaves cores idle at the
+// end of a batch. parallelFor instead cuts the range into tasks of about equal
+// estimated cost, deals them to per-worker deques, and idle workers steal from
+// the others. The calling thread takes part as worker 0.
+class TaskPool
+{
+  public:
+    // threads <= 0 uses all hardware threads; pin binds worker i to the i-th allowed CPU where supported.
+    // The calling thread is worker 0 and gets its own affinity back when the pool is destroyed,
+    // so destroy the pool on the thread that created it.
+    TaskPool(int threads = 0, bool pin = false);
+
+    typedef std::function<void(int begin, int end, int worker)> Body;
+    typedef std::function<float(int index)> Cost;
+
+    // Run body over [0, count). With a cost estimate the tasks are balanced by
+    // cost, otherwise by count. Returns when all tasks have finished.
+    void parallelFor(int count, const Body &body, const Cost &cost = Cost());
+
+    int getWorkerCount() { return (int)workers.size(); }
+
+    struct WorkerStats
+    {
+        long long tasks;
+        long long stolen;
+        double busySeconds;
+    };
+    WorkerStats getStats(int worker);
+    void resetStats();
+    void printStats(std::ostream &out);
+
+    ~TaskPool();
+
+    // Tasks per worker per parallelFor, more gives finer balancing
+    static const int TasksPerWorker = 16;
+
+  private:
+    struct Task
+    {
+        int begin, end;
+    };
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+        WorkerStats stats;
+    };
+
+    void workerLoop(int index);
+    void runTasks(int index);
+    bool popTask(int index, Task &task, bool &stolen);
+
+    std::vector<Worker *> workers;
+    const Body *body;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    long long generation;
+    std::atomic<int> remaining;
+    int active;
+    bool stopping;
+#ifdef __linux__
+    bool pinned;
+    cpu_set_t callerAffinity;
+#endif
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include <chrono>
+#include <iostream>
+#include <string.h>
+
+#include "video_output.h"
+
+#ifdef WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+inline double video_time()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+VideoOutput::VideoOutput(const std::string &target, int _width, int _height, int _fps, Format _format)
+    : width(_width), height(_height), fps(_fps), format(_format)
+{
+    isPipe = false;
+    if (target == "-")
+    {
+        file = stdout;
+    }
+    else if (!target.empty() && target[0] == '|')
+    {
+        file = popen(target.c_str() + 1, "w");
+        isPipe = true;
+    }
+    else
+    {
+        file = fopen(target.c_str(), "wb");
+    }
+    if (file == nullptr)
+    {
+        std::cerr << "video output: cannot open " << target << std::endl;
+    }
+    else if (format == FormatY4M)
+    {
+        fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+    }
+
+    glGenBuffers(RingSize, pixelBuffers);
+    for (int i = 0; i < RingSize; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, nullptr, GL_STREAM_READ);
+        fences[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (int i = 0; i < QueueSize; i++)
+        freeBuffers.push_back(std::vector<unsigned char>(width * height * 3));
+
+    framesQueued = 0;
+    framesWritten = 0;
+    readbackStall = 0;
+    encodeStall = 0;
+    writerTime = 0;
+    finishing = false;
+    finished = false;
+    writer = std::thread([this] { writerLoop(); });
+}
+
+void VideoOutput::addFrame(int x, int y)
+{
+    if (finished)
+        return;
+    int slot = framesQueued % RingSize;
+    if (fences[slot] != 0)
+        collect(slot);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[slot]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    framesQueued++;
+}
+
+void VideoOutput::collect(int slot)
+{
+    double t0 = video_time();
+    glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fences[slot]);
+    fences[slot] = 0;
+    double t1 = video_time();
+    readbackStall += t1 - t0;
+
+    std::vector<unsigned char> buffer;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return !freeBuffers.empty(); });
+        buffer.swap(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+    encodeStall += video_time() - t1;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[slot]);
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width * height * 3, GL_MAP_READ_BIT);
+    if (pixels != nullptr)
+        memcpy(&buffer[0], pixels, width * height * 3);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::vector<unsigned char>());
+        pending.back().swap(buffer);
+    }
+    condition.notify_all();
+}
+
+void VideoOutput::writerLoop()
+{
+    while (true)
+    {
+        std::vector<unsigned char> buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return finishing || !pending.empty(); });
+            if (pending.empty())
+                return;
+            buffer.swap(pending.front());
+            pending.pop_front();
+        }
+        double t0 = video_time();
+        if (file != nullptr)
+            writeFrame(buffer);
+        double t1 = video_time();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writerTime += t1 - t0;
+            framesWritten++;
+            freeBuffers.push_back(std::vector<unsigned char>());
+            freeBuffers.back().swap(buffer);
+        }
+        condition.notify_all();
+    }
+}
+
+void VideoOutput::writeFrame(const std::vector<unsigned char> &rgb)
+{
+    // OpenGL rows are bottom to top, video rows top to bottom
+    int stride = width * 3;
+    if (format == FormatRaw)
+    {
+        for (int y = height - 1; y >= 0; y--)
+            fwrite(&rgb[y * stride], 1, stride, file);
+        return;
+    }
+    int n = width * height;
+    planes.resize(n * 3);
+    unsigned char *Y = &planes[0], *U = &planes[n], *V = &planes[n * 2];
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *row = &rgb[(height - 1 - y) * stride];
+        for (int x = 0; x < width; x++)
+        {
+            // BT.601, limited range
+            int r = row[x * 3], g = row[x * 3 + 1], b = row[x * 3 + 2];
+            int i = y * width + x;
+            Y[i] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            U[i] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            V[i] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+    fputs("FRAME\n", file);
+    fwrite(&planes[0], 1, n * 3, file);
+}
+
+void VideoOutput::finish()
+{
+    if (finished)
+        return;
+    for (long long i = framesQueued - RingSize; i < framesQueued; i++)
+    {
+        if (i >= 0 && fences[i % RingSize] != 0)
+            collect(i % RingSize);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+    }
+    condition.notify_all();
+    writer.join();
+    if (file != nullptr)
+    {
+        if (isPipe)
+            pclose(file);
+        else if (file != stdout)
+            fclose(file);
+        else
+            fflush(file);
+        file = nullptr;
+    }
+    finished = true;
+}
+
+VideoOutput::~VideoOutput()
+{
+    finish();
+    glDeleteBuffers(RingSize, pixelBuffers);
+}
@@ -0,0 +1,92 @@
+#ifndef BUDDHABROT_RENDERER_VIDEO_OUTPUT_H
+#define BUDDHABROT_RENDERER_VIDEO_OUTPUT_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opengl.h"
+
+// Streams rendered frames to a file or a pipe (e.g. ffmpeg's stdin) without
+// making the render loop wait for readback or disk I/O.
+//
+// Frames are read back into a ring of pixel buffer objects; a readback is only
+// collected RingSize frames later when the GPU has long finished it. The pixels
+// are then handed to a writer thread that converts and writes them. Time the
+// render thread spends waiting on either side is reported as a stall,
+// separately from the writer's own encode time.
+class VideoOutput
+{
+  public:
+    enum Format
+    {
+        FormatY4M, // YUV4MPEG2, 4:4:4, readable by ffmpeg -i -
+        FormatRaw  // rgb24 rows, top to bottom
+    };
+
+    // target is a file path, "-" for stdout, or "|command" to pipe into a command
+    VideoOutput(const std::string &target, int width, int height, int fps, Format format);
+
+    bool isOpen() { return file != nullptr; }
+
+    // Queue the width x height region at (x, y) of the current read framebuffer
+    void addFrame(int x, int y);
+    // Collect all pending readbacks, drain the writer and close the sink
+    void finish();
+
+    // The writer thread updates these two, read them under the queue mutex
+    int getFramesWritten()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return framesWritten;
+    }
+    // Seconds the render thread waited for a readback fence
+    double getReadbackStall() { return readbackStall; }
+    // Seconds the render thread waited because the writer was behind
+    double getEncodeStall() { return encodeStall; }
+    // Seconds the writer thread spent converting and writing
+    double getWriterTime()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return writerTime;
+    }
+
+    ~VideoOutput();
+
+    static const int RingSize = 3;
+    static const int QueueSize = 4;
+
+  private:
+    void collect(int slot);
+    void writerLoop();
+    void writeFrame(const std::vector<unsigned char> &rgb);
+
+    int width, height, fps;
+    Format format;
+    FILE *file;
+    bool isPipe;
+
+    GLuint pixelBuffers[RingSize];
+    GLsync fences[RingSize];
+    long long framesQueued;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::vector<unsigned char>> pending;
+    std::vector<std::vector<unsigned char>> freeBuffers;
+    bool finishing;
+    bool finished;
+
+    int framesWritten;
+    double readbackStall;
+    double encodeStall;
+    double writerTime;
+    std::vector<unsigned char> planes;
+};
+
+#endif